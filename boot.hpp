@@ -0,0 +1,129 @@
+#ifndef FLYWHEEL_BOOT_HPP
+#define FLYWHEEL_BOOT_HPP
+
+#include <freertos/FreeRTOS.h>
+#include <freertos/semphr.h>
+#include <freertos/task.h>
+#include <esp_timer.h>
+#include <esp32-hal-psram.h>
+
+#include "sd.hpp"
+#include "kv.hpp"
+#include "power.hpp"
+
+extern FlywheelSD sd;
+extern FlywheelKV kv;
+extern FlywheelPower power;
+
+#define BOOT_MAX_STAGES 24
+
+class FlywheelBoot {
+public:
+    struct Stage {
+        const char* name;
+        int64_t timestamp; // Microseconds since power-on
+        int core;
+    };
+
+    // Record that a stage finished. Names must outlive the boot log (string literals).
+    void mark(const char* name) {
+        int64_t now = esp_timer_get_time();
+        portENTER_CRITICAL(&lock);
+        if (stageCount < BOOT_MAX_STAGES) {
+            stages[stageCount++] = {name, now, xPortGetCoreID()};
+        }
+        portEXIT_CRITICAL(&lock);
+    }
+
+    // Record a stage only the first time it happens
+    void mark_once(const char* name, bool& flag) {
+        if (flag) return;
+        flag = true;
+        mark(name);
+    }
+
+    size_t stage_count() const {
+        return stageCount;
+    }
+
+    const Stage& stage(size_t i) const {
+        return stages[i];
+    }
+
+    // Mount the card and read init.lua on the other core while the caller keeps booting
+    void start_storage(const char* initPath) {
+        storageDone = xSemaphoreCreateBinary();
+        this->initPath = initPath;
+        if (xTaskCreatePinnedToCore(storage_task, "BootStorage", 8192, this, 2, nullptr, 0) != pdPASS) {
+            // No task, so wait_storage() would never be signalled: do the work here instead
+            Serial.println("Boot: storage task failed, loading inline");
+            load_storage();
+            xSemaphoreGive(storageDone);
+        }
+    }
+
+    // Block until start_storage() is finished. The returned script is owned by the boot object.
+    const char* wait_storage(size_t& scriptLen) {
+        xSemaphoreTake(storageDone, portMAX_DELAY);
+        vSemaphoreDelete(storageDone);
+        storageDone = nullptr;
+        scriptLen = initScriptLen;
+        return initScript;
+    }
+
+    // Release the prefetched script once it has been executed
+    void release_script() {
+        free(initScript);
+        initScript = nullptr;
+        initScriptLen = 0;
+    }
+
+private:
+    Stage stages[BOOT_MAX_STAGES];
+    volatile size_t stageCount = 0;
+    portMUX_TYPE lock = portMUX_INITIALIZER_UNLOCKED;
+
+    SemaphoreHandle_t storageDone = nullptr;
+    const char* initPath = nullptr;
+    char* initScript = nullptr;
+    size_t initScriptLen = 0;
+
+    static void storage_task(void* parameter) {
+        FlywheelBoot* boot = static_cast<FlywheelBoot*>(parameter);
+        boot->load_storage();
+        xSemaphoreGive(boot->storageDone);
+        vTaskDelete(nullptr);
+    }
+
+    void load_storage() {
+        FlywheelPower::AwakeHold awake(power); // Keep the card clocked while mounting and reading
+        if (sd.begin()) {
+            mark("sd_mounted");
+            kv.begin();
+            mark("kv_recovered");
+            prefetch_script();
+            mark("init_prefetched");
+        } else {
+            Serial.println("Boot: SD mount failed");
+        }
+    }
+
+    void prefetch_script() {
+        FlywheelFile file;
+        if (!file.open(sd, initPath, O_RDONLY)) {
+            Serial.printf("Boot: %s not found\n", initPath);
+            return;
+        }
+
+        size_t size = file.size();
+        initScript = static_cast<char*>(psramFound() ? ps_malloc(size + 1) : malloc(size + 1));
+        if (!initScript) {
+            Serial.println("Boot: no memory for init script");
+            return;
+        }
+        initScriptLen = file.read(initScript, size);
+        initScript[initScriptLen] = '\0';
+    }
+};
+
+#endif
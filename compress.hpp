@@ -0,0 +1,270 @@
+#ifndef FLYWHEEL_COMPRESS_HPP
+#define FLYWHEEL_COMPRESS_HPP
+
+#include <freertos/FreeRTOS.h>
+#include <freertos/semphr.h>
+#include <freertos/task.h>
+#include <esp_heap_caps.h>
+#include <esp_timer.h>
+
+#include "sd.hpp"
+#include "power.hpp"
+
+extern FlywheelSD sd;
+extern FlywheelPower power;
+
+// FLZ container, produced by tools/flz.py:
+//   "FLZ1" | rawSize u32 | blockSize u32 | blockCount u32 | blockCount x u32 sizes | blocks
+// Every block decodes to blockSize bytes (the last may be shorter) independently,
+// so any block can be located from the size table and decoded on its own. Blocks
+// are LZ4 block format; FLZ_STORED in a size marks a block kept uncompressed.
+#define FLZ_MAGIC "FLZ1"
+#define FLZ_HEADER_SIZE 16
+#define FLZ_STORED 0x80000000u
+#define FLZ_MAX_BLOCK (64 * 1024)
+
+struct FlywheelLoadStats {
+    bool compressed = false;
+    uint32_t rawBytes = 0;   // Bytes delivered to the destination
+    uint32_t fileBytes = 0;  // Bytes read from the card
+    uint32_t totalUs = 0;
+    uint32_t readUs = 0;     // Time the reader spent in SD reads
+    uint32_t decodeUs = 0;   // Time spent decoding blocks
+};
+
+// Decode one LZ4 block. Returns the number of bytes written, or -1 if the input is malformed.
+inline int32_t flz_decode_block(const uint8_t* src, size_t srcLen, uint8_t* dst, size_t dstCapacity) {
+    const uint8_t* ip = src;
+    const uint8_t* const ipEnd = src + srcLen;
+    uint8_t* op = dst;
+    uint8_t* const opEnd = dst + dstCapacity;
+
+    while (ip < ipEnd) {
+        uint8_t token = *ip++;
+
+        size_t literals = token >> 4;
+        if (literals == 15) {
+            uint8_t extra;
+            do {
+                if (ip >= ipEnd) return -1;
+                extra = *ip++;
+                literals += extra;
+            } while (extra == 255);
+        }
+        if ((size_t)(ipEnd - ip) < literals || (size_t)(opEnd - op) < literals) return -1;
+        memcpy(op, ip, literals);
+        ip += literals;
+        op += literals;
+
+        if (ip == ipEnd) break; // The last sequence carries literals only
+
+        if (ipEnd - ip < 2) return -1;
+        size_t offset = ip[0] | (ip[1] << 8);
+        ip += 2;
+        if (offset == 0 || offset > (size_t)(op - dst)) return -1;
+
+        size_t length = (token & 0x0F) + 4;
+        if ((token & 0x0F) == 15) {
+            uint8_t extra;
+            do {
+                if (ip >= ipEnd) return -1;
+                extra = *ip++;
+                length += extra;
+            } while (extra == 255);
+        }
+        if ((size_t)(opEnd - op) < length) return -1;
+
+        // Matches may overlap their own output, so copy forwards byte by byte when close
+        const uint8_t* match = op - offset;
+        if (offset >= length) {
+            memcpy(op, match, length);
+            op += length;
+        } else {
+            while (length--) *op++ = *match++;
+        }
+    }
+    return op - dst;
+}
+
+// Streams an FLZ file into memory. A reader task on the other core fetches the
+// next block from the card while the caller decodes the current one straight
+// into the destination buffer.
+class FlywheelCompressedLoader {
+public:
+    // Check for an FLZ header and report the decoded size
+    static bool probe(const char* path, uint32_t& rawSize) {
+        FlywheelFile file;
+        uint8_t header[FLZ_HEADER_SIZE];
+        if (!file.open(sd, path, O_RDONLY) || file.read(header, FLZ_HEADER_SIZE) != FLZ_HEADER_SIZE) {
+            return false;
+        }
+        if (memcmp(header, FLZ_MAGIC, 4) != 0) return false;
+        memcpy(&rawSize, header + 4, 4);
+        return true;
+    }
+
+    // Decode path into dst. Returns false on I/O errors, malformed data or a short buffer.
+    bool load(const char* path, uint8_t* dst, size_t dstCapacity, FlywheelLoadStats& stats) {
+        FlywheelPower::AwakeHold awake(power); // The reader task owns the card until we return
+        int64_t start = esp_timer_get_time();
+        stats = FlywheelLoadStats();
+        stats.compressed = true;
+
+        if (!file.open(sd, path, O_RDONLY) || !read_header(dstCapacity)) {
+            cleanup();
+            return false;
+        }
+
+        // Two input buffers, in internal RAM when there's room since that's where decoding reads
+        uint32_t slotSize = blockSize + blockSize / 255 + 16; // LZ4 worst case for one block
+        for (int i = 0; i < 2; i++) {
+            slots[i] = static_cast<uint8_t*>(heap_caps_malloc(slotSize, MALLOC_CAP_INTERNAL | MALLOC_CAP_8BIT));
+            if (!slots[i]) slots[i] = static_cast<uint8_t*>(ps_malloc(slotSize));
+            if (!slots[i]) {
+                cleanup();
+                return false;
+            }
+        }
+        slotCapacity = slotSize;
+        filled = xSemaphoreCreateCounting(2, 0);
+        freed = xSemaphoreCreateCounting(2, 2);
+        readerFailed = false;
+        readUs = 0;
+        if (!filled || !freed) {
+            cleanup();
+            return false;
+        }
+
+        readerDone = xSemaphoreCreateBinary();
+        int readerCore = xPortGetCoreID() == 0 ? 1 : 0;
+        if (!readerDone || xTaskCreatePinnedToCore(reader_task, "FLZReader", 4096, this, 2, nullptr, readerCore) != pdPASS) {
+            cleanup();
+            return false;
+        }
+
+        bool ok = true;
+        uint32_t produced = 0;
+        for (uint32_t i = 0; i < blockCount; i++) {
+            xSemaphoreTake(filled, portMAX_DELAY);
+            if (readerFailed) {
+                ok = false;
+                break;
+            }
+
+            uint32_t expected = min(blockSize, rawSize - produced);
+            uint32_t size = sizes[i] & ~FLZ_STORED;
+            const uint8_t* src = slots[i % 2];
+
+            int64_t decodeStart = esp_timer_get_time();
+            if (sizes[i] & FLZ_STORED) {
+                ok = size == expected;
+                if (ok) memcpy(dst + produced, src, size);
+            } else {
+                ok = flz_decode_block(src, size, dst + produced, expected) == (int32_t)expected;
+            }
+            stats.decodeUs += esp_timer_get_time() - decodeStart;
+
+            xSemaphoreGive(freed);
+            if (!ok) break;
+            produced += expected;
+        }
+
+        // Let the reader finish or notice we stopped consuming
+        abort = !ok;
+        xSemaphoreGive(freed);
+        xSemaphoreTake(readerDone, portMAX_DELAY);
+
+        stats.rawBytes = produced;
+        stats.fileBytes = fileBytes;
+        stats.readUs = readUs;
+        cleanup();
+        stats.totalUs = esp_timer_get_time() - start;
+        return ok && produced == rawSize;
+    }
+
+private:
+    FlywheelFile file;
+    uint32_t rawSize = 0;
+    uint32_t blockSize = 0;
+    uint32_t blockCount = 0;
+    uint32_t* sizes = nullptr;
+    uint32_t dataStart = 0;
+    uint32_t fileBytes = 0;
+
+    uint8_t* slots[2] = {nullptr, nullptr};
+    uint32_t slotCapacity = 0;
+    SemaphoreHandle_t filled = nullptr;  // Blocks ready for decoding
+    SemaphoreHandle_t freed = nullptr;   // Slots ready for reading
+    SemaphoreHandle_t readerDone = nullptr;
+    volatile bool readerFailed = false;
+    volatile bool abort = false;
+    uint32_t readUs = 0;
+
+    // Parse the header and block table, rejecting anything that won't fit in capacity before allocating
+    bool read_header(size_t capacity) {
+        uint8_t header[FLZ_HEADER_SIZE];
+        if (file.read(header, FLZ_HEADER_SIZE) != FLZ_HEADER_SIZE || memcmp(header, FLZ_MAGIC, 4) != 0) {
+            return false;
+        }
+        memcpy(&rawSize, header + 4, 4);
+        memcpy(&blockSize, header + 8, 4);
+        memcpy(&blockCount, header + 12, 4);
+        if (rawSize > capacity || blockSize == 0 || blockSize > FLZ_MAX_BLOCK) {
+            return false;
+        }
+        // The table holds exactly one entry per block; 64-bit so a huge rawSize can't wrap the count
+        if (blockCount != ((uint64_t)rawSize + blockSize - 1) / blockSize) {
+            return false;
+        }
+
+        if (blockCount) {
+            sizes = static_cast<uint32_t*>(malloc(blockCount * sizeof(uint32_t)));
+            if (!sizes || file.read(sizes, blockCount * sizeof(uint32_t)) != blockCount * sizeof(uint32_t)) {
+                return false;
+            }
+        }
+        dataStart = FLZ_HEADER_SIZE + blockCount * sizeof(uint32_t);
+        fileBytes = dataStart;
+        return true;
+    }
+
+    static void reader_task(void* parameter) {
+        FlywheelCompressedLoader* loader = static_cast<FlywheelCompressedLoader*>(parameter);
+        for (uint32_t i = 0; i < loader->blockCount; i++) {
+            xSemaphoreTake(loader->freed, portMAX_DELAY);
+            if (loader->abort) break;
+
+            uint32_t size = loader->sizes[i] & ~FLZ_STORED;
+            int64_t readStart = esp_timer_get_time();
+            bool ok = size <= loader->slotCapacity && loader->file.read(loader->slots[i % 2], size) == size;
+            loader->readUs += esp_timer_get_time() - readStart;
+            loader->fileBytes += size;
+
+            if (!ok) {
+                loader->readerFailed = true;
+                xSemaphoreGive(loader->filled);
+                break;
+            }
+            xSemaphoreGive(loader->filled);
+        }
+        xSemaphoreGive(loader->readerDone);
+        vTaskDelete(nullptr);
+    }
+
+    void cleanup() {
+        file.close();
+        free(sizes);
+        sizes = nullptr;
+        for (int i = 0; i < 2; i++) {
+            free(slots[i]);
+            slots[i] = nullptr;
+        }
+        if (filled) vSemaphoreDelete(filled);
+        if (freed) vSemaphoreDelete(freed);
+        if (readerDone) vSemaphoreDelete(readerDone);
+        filled = freed = readerDone = nullptr;
+        abort = false;
+    }
+};
+
+#endif
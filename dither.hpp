@@ -0,0 +1,147 @@
+#ifndef FLYWHEEL_DITHER_HPP
+#define FLYWHEEL_DITHER_HPP
+
+#include <stdint.h>
+#include <string.h>
+
+#define DITHER_MAX_SOURCE 160  // Source pixels per row
+#define DITHER_MAX_BYTES 64    // Packed destination bytes per row, plus spill
+#define DITHER_PATTERN_ROWS 4  // Dither patterns repeat every 4 lines
+
+enum FlywheelDitherMode : uint8_t {
+    DITHER_THRESHOLD, // Only the darkest shade is black
+    DITHER_BAYER,     // 4x4 ordered dither
+    DITHER_TEMPORAL,  // 2x2 ordered dither, inverted on alternate frames
+};
+
+// Converts rows of 2-bit shades (0 = lightest) into packed 1-bit display rows,
+// scaled horizontally. Every source pixel covers at most two destination bytes,
+// so for each pattern row, source x and shade the finished bits are precomputed
+// as a 16-bit mask. Rendering a row is then one lookup and two ORs per source
+// pixel, whichever mode is selected.
+class FlywheelDither {
+public:
+    // Scale srcWidth pixels by scale (at most 8) and place them offsetX pixels into the line
+    void begin(uint16_t srcWidth, float scale, int16_t offsetX) {
+        sourceWidth = min(srcWidth, (uint16_t)DITHER_MAX_SOURCE);
+        dstScale = scale;
+        dstOffset = offsetX;
+        build();
+    }
+
+    void set_mode(FlywheelDitherMode newMode) {
+        mode = newMode;
+        build();
+    }
+
+    FlywheelDitherMode get_mode() const {
+        return mode;
+    }
+
+    // Advance the temporal pattern; call once per displayed frame
+    void next_frame() {
+        phase = mode == DITHER_TEMPORAL ? phase ^ 1 : 0;
+    }
+
+    // Render one row of shades into a packed display line, as screen line y
+    void render_row(const uint8_t* shades, uint8_t* line, int16_t y) const {
+        uint8_t row[DITHER_MAX_BYTES] = {0};
+        const uint16_t (*lut)[4] = masks[phase][y & (DITHER_PATTERN_ROWS - 1)];
+        for (uint16_t x = 0; x < sourceWidth; x++) {
+            uint16_t mask = lut[x][shades[x] & 0x03];
+            uint8_t* p = row + byteIndex[x];
+            p[0] |= mask;
+            p[1] |= mask >> 8;
+        }
+
+        // Bits outside the scaled span keep whatever the line already had
+        uint8_t* out = line + firstByte;
+        for (uint8_t i = 0; i < byteCount; i++) {
+            uint8_t keep = (i == 0 ? keepFirst : 0) | (i == byteCount - 1 ? keepLast : 0);
+            out[i] = (out[i] & keep) | row[i];
+        }
+    }
+
+private:
+    FlywheelDitherMode mode = DITHER_THRESHOLD;
+    uint8_t phase = 0;
+    uint16_t sourceWidth = 0;
+    float dstScale = 1;
+    int16_t dstOffset = 0;
+
+    uint16_t masks[2][DITHER_PATTERN_ROWS][DITHER_MAX_SOURCE][4];
+    uint8_t byteIndex[DITHER_MAX_SOURCE]; // First destination byte of each source pixel, relative to firstByte
+    uint8_t firstByte = 0;
+    uint8_t byteCount = 0;
+    uint8_t keepFirst = 0;
+    uint8_t keepLast = 0;
+
+    static constexpr uint8_t BAYER4[4][4] = {
+        {0, 8, 2, 10},
+        {12, 4, 14, 6},
+        {3, 11, 1, 9},
+        {15, 7, 13, 5},
+    };
+    static constexpr uint8_t BAYER2[2][2] = {
+        {0, 2},
+        {3, 1},
+    };
+
+    // Whether screen pixel (x, y) of the given shade is white
+    bool is_white(uint8_t shade, int16_t x, int16_t y, uint8_t framePhase) const {
+        uint8_t level = 3 - shade; // 3 = white, 0 = black
+        switch (mode) {
+            case DITHER_BAYER: {
+                // White when level / 3 > (b + 0.5) / 16
+                uint8_t b = BAYER4[y & 3][x & 3];
+                return level * 32 > b * 6 + 3;
+            }
+            case DITHER_TEMPORAL: {
+                uint8_t b = BAYER2[y & 1][x & 1];
+                if (framePhase) b = 3 - b;
+                return level * 8 > b * 6 + 3;
+            }
+            default:
+                return shade <= 2;
+        }
+    }
+
+    void build() {
+        if (sourceWidth == 0) return;
+        int16_t dstWidth = int(sourceWidth * dstScale);
+        firstByte = dstOffset >> 3;
+        byteCount = ((dstOffset + dstWidth - 1) >> 3) - firstByte + 1;
+        keepFirst = (1 << (dstOffset & 7)) - 1;
+        keepLast = ~((2 << ((dstOffset + dstWidth - 1) & 7)) - 1);
+
+        memset(masks, 0, sizeof(masks));
+        memset(byteIndex, 0xFF, sizeof(byteIndex));
+        for (int16_t x = 0; x < dstWidth; x++) {
+            int srcX = x / dstScale;
+            int16_t screenX = dstOffset + x;
+            uint8_t byte = (screenX >> 3) - firstByte;
+            if (byteIndex[srcX] == 0xFF) byteIndex[srcX] = byte;
+            uint16_t bit = 1 << ((byte - byteIndex[srcX]) * 8 + (screenX & 7));
+
+            for (uint8_t framePhase = 0; framePhase < 2; framePhase++) {
+                for (int16_t y = 0; y < DITHER_PATTERN_ROWS; y++) {
+                    for (uint8_t shade = 0; shade < 4; shade++) {
+                        if (is_white(shade, screenX, y, framePhase)) {
+                            masks[framePhase][y][srcX][shade] |= bit;
+                        }
+                    }
+                }
+            }
+        }
+        // Source pixels that scale to nothing point at byte 0 with empty masks
+        for (uint16_t x = 0; x < sourceWidth; x++) {
+            if (byteIndex[x] == 0xFF) byteIndex[x] = 0;
+        }
+        phase = 0;
+    }
+};
+
+constexpr uint8_t FlywheelDither::BAYER4[4][4];
+constexpr uint8_t FlywheelDither::BAYER2[2][2];
+
+#endif
@@ -8,33 +8,72 @@
 
 #include "sd.hpp"
 #include "graphics.hpp"
+#include "rewind.hpp"
+#include "power.hpp"
+#include "compress.hpp"
+#include "dither.hpp"
 
 extern FlywheelSD sd;
+extern FlywheelPower power;
 
 class FlywheelGB {
 private:
     struct gb_s gb;                  // PeanutGB state
     uint8_t* romBuffer = nullptr;    // Pointer to ROM buffer
     size_t romSize = 0;              // Size of the loaded ROM
+    FlywheelLoadStats romLoadStats;  // Timing of the last load_rom()
     bool emulatorRunning = false;    // Status of the emulator
     TaskHandle_t emulatorTaskHandle = nullptr; // Task handle for the emulator
 
     static constexpr uint32_t FRAME_DURATION_MS = 1000 / 60; // 60 FPS
     uint8_t framebuffer[160 * 144]; // Framebuffer for the Game Boy display (160x144 pixels)
 
+    FlywheelRewind rewindBuffer;     // Snapshot history in PSRAM
+    uint32_t rewindInterval = REWIND_DEFAULT_INTERVAL; // Frames between snapshots
+    uint32_t rewindBudget = REWIND_DEFAULT_BUDGET;
+    bool rewindEnabled = true;
+    volatile uint32_t rewindRequest = 0; // Steps requested by Lua, served between frames
+    volatile uint32_t rewindResult = 0;
+    uint32_t frameCount = 0;
+    float avgFrameUs = 0;            // Emulation time per frame, excluding pacing
+
+    // Screen placement of the scaled framebuffer
+    static constexpr float DRAW_SCALE = 1.66f;
+    static constexpr int DRAW_WIDTH = int(160 * DRAW_SCALE);
+    static constexpr int DRAW_HEIGHT = int(144 * DRAW_SCALE);
+    static constexpr int DRAW_OFFSET_X = (DISPLAY_WIDTH - DRAW_WIDTH) / 2;
+    static constexpr int DRAW_OFFSET_Y = (DISPLAY_HEIGHT - DRAW_HEIGHT) / 2;
+    FlywheelDither dither;           // Shade to 1-bit conversion tables
+
     static FlywheelGB* instance; // Static instance pointer
 
     // Task to run the emulator loop
     static void emulator_task(void* parameter) {
         FlywheelGB* inst = static_cast<FlywheelGB*>(parameter);
+        const int64_t frameUs = FRAME_DURATION_MS * 1000;
+        int64_t nextFrame = esp_timer_get_time();
         while (inst->emulatorRunning) {
-            uint32_t start = millis();
+            nextFrame += frameUs;
+
+            if (inst->rewindRequest) {
+                inst->rewindResult = inst->rewindBuffer.rewind(inst->rewindRequest, reinterpret_cast<uint8_t*>(&inst->gb));
+                inst->rewindRequest = 0;
+            }
 
+            int64_t frameStart = esp_timer_get_time();
             inst->run_frame();
+            uint32_t emulatedUs = esp_timer_get_time() - frameStart;
+            inst->avgFrameUs = inst->avgFrameUs == 0 ? emulatedUs : inst->avgFrameUs * 0.95f + emulatedUs * 0.05f;
+
+            if (++inst->frameCount % inst->rewindInterval == 0) {
+                inst->rewindBuffer.capture(reinterpret_cast<const uint8_t*>(&inst->gb));
+            }
 
-            uint32_t frameTime = millis() - start;
-            if (frameTime < FRAME_DURATION_MS) {
-                vTaskDelay(pdMS_TO_TICKS(FRAME_DURATION_MS - frameTime));
+            // Hand the rest of the frame to the governor
+            power.idle_until(POWER_CLIENT_EMULATOR, nextFrame);
+            int64_t now = esp_timer_get_time();
+            if (now - nextFrame > frameUs) {
+                nextFrame = now; // Fell behind; don't race to catch up
             }
         }
         vTaskDelete(nullptr);
@@ -80,13 +119,20 @@ private:
 
 
 public:
-    // Load ROM from SD card
+    FlywheelGB() {
+        dither.begin(160, DRAW_SCALE, DRAW_OFFSET_X);
+    }
+
+    // Load ROM from SD card, either raw or FLZ-compressed (see tools/flz.py)
     String load_rom(const char* path) {
         if (!sd.is_initialized()) {
             return "SD card not initialized.";
         }
 
-        romSize = sd.get_file_size(path);
+        int64_t start = esp_timer_get_time();
+        uint32_t rawSize = 0;
+        bool compressed = FlywheelCompressedLoader::probe(path, rawSize);
+        romSize = compressed ? rawSize : sd.get_file_size(path);
         if (romSize == 0) {
             return "Failed to get ROM size or file not found.";
         }
@@ -97,6 +143,7 @@ public:
 
         if (romBuffer) {
             free(romBuffer);
+            romBuffer = nullptr;
         }
 
         if (!psramFound()) {
@@ -108,14 +155,27 @@ public:
             return "Failed to allocate memory for ROM.";
         }
 
-        size_t bytesRead;
-        if (!sd.read_binary_file(path, romBuffer, romSize, bytesRead) || bytesRead != romSize) {
+        bool loaded;
+        if (compressed) {
+            FlywheelCompressedLoader loader;
+            loaded = loader.load(path, romBuffer, romSize, romLoadStats);
+        } else {
+            size_t bytesRead;
+            loaded = sd.read_binary_file(path, romBuffer, romSize, bytesRead) && bytesRead == romSize;
+            romLoadStats = FlywheelLoadStats();
+            romLoadStats.rawBytes = romLoadStats.fileBytes = romSize;
+            romLoadStats.totalUs = romLoadStats.readUs = esp_timer_get_time() - start;
+        }
+
+        if (!loaded) {
             free(romBuffer);
             romBuffer = nullptr;
             romSize = 0;
             return "Failed to load ROM from SD card.";
         }
 
+        Serial.printf("ROM loaded: %u bytes (%u from card) in %u us\n",
+                      romLoadStats.rawBytes, romLoadStats.fileBytes, romLoadStats.totalUs);
         return "success";
     }
 
@@ -142,7 +202,16 @@ public:
 
         gb.display.lcd_draw_line = custom_draw_line;
 
+        // Snapshots are the raw PeanutGB state, so history from a previous ROM is useless
+        rewindBuffer.end();
+        if (rewindEnabled && !rewindBuffer.begin(sizeof(gb), rewindBudget)) {
+            Serial.println("Rewind unavailable: not enough PSRAM.");
+        }
+        frameCount = 0;
+        rewindRequest = 0;
+
         emulatorRunning = true;
+        power.set_active(POWER_CLIENT_EMULATOR, true);
 
         // 🔁 Increase stack size from 8192 → 16384
         xTaskCreatePinnedToCore(emulator_task, "EmulatorTask", 16384, this, 1, &emulatorTaskHandle, 0);
@@ -159,6 +228,7 @@ public:
         }
 
         emulatorRunning = false;
+        power.set_active(POWER_CLIENT_EMULATOR, false);
 
         // Wait for the task to terminate
         if (emulatorTaskHandle) {
@@ -191,34 +261,73 @@ public:
         gb.direct.joypad_bits.start  = !start;
     }
 
+    // Configure snapshot history, applied the next time the emulator starts
+    bool configure_rewind(bool enabled, uint32_t intervalFrames, uint32_t budgetBytes) {
+        if (emulatorRunning) {
+            Serial.println("Stop the emulator before reconfiguring rewind.");
+            return false;
+        }
+        rewindEnabled = enabled;
+        rewindInterval = max(intervalFrames, (uint32_t)1);
+        rewindBudget = budgetBytes;
+        rewindBuffer.end();
+        return true;
+    }
+
+    // Step back through snapshot history. Served by the emulator task between
+    // frames; returns the number of snapshots actually stepped back.
+    uint32_t rewind(uint32_t steps) {
+        if (!rewindBuffer.is_enabled() || steps == 0) return 0;
+        if (!emulatorRunning) {
+            return rewindBuffer.rewind(steps, reinterpret_cast<uint8_t*>(&gb));
+        }
+
+        rewindResult = 0;
+        rewindRequest = steps;
+        for (int i = 0; i < 100 && rewindRequest; i++) {
+            vTaskDelay(1);
+        }
+        return rewindResult;
+    }
+
+    const FlywheelLoadStats& get_load_stats() const {
+        return romLoadStats;
+    }
+
+    const FlywheelRewind& get_rewind() const {
+        return rewindBuffer;
+    }
+
+    uint32_t get_rewind_interval() const {
+        return rewindInterval;
+    }
+
+    float get_avg_frame_us() const {
+        return avgFrameUs;
+    }
+
     // Retrieve the framebuffer for rendering
     const uint8_t* get_framebuffer() const {
         return framebuffer;
     }
 
-    // Draw framebuffer to screen
+    void set_dither_mode(FlywheelDitherMode mode) {
+        dither.set_mode(mode);
+    }
+
+    FlywheelDitherMode get_dither_mode() const {
+        return dither.get_mode();
+    }
+
+    // Draw framebuffer to screen, scaled and converted to 1-bit per the dither mode
     void draw_framebuffer() {
-        const float scale = 1.66f;
-        const int src_w = 160;
-        const int src_h = 144;
-        const int dst_w = int(src_w * scale);  // 266
-        const int dst_h = int(src_h * scale);  // 239
-        const int screen_w = 400;
-        const int screen_h = 240;
-        const int offset_x = (screen_w - dst_w) / 2;
-        const int offset_y = (screen_h - dst_h) / 2;
-
-        for (int y = 0; y < dst_h; ++y) {
-            int src_y = y / scale;
-            for (int x = 0; x < dst_w; ++x) {
-                int src_x = x / scale;
-                uint8_t pixel = framebuffer[src_y * src_w + src_x] & 0x03;
-
-                uint8_t mono = (pixel > 2) ? 0 : 1;
-
-                graphics.drawPixel(offset_x + x, offset_y + y, mono);
-            }
+        dither.next_frame();
+        for (int y = 0; y < DRAW_HEIGHT; ++y) {
+            int src_y = y / DRAW_SCALE;
+            int screen_y = DRAW_OFFSET_Y + y;
+            dither.render_row(&framebuffer[src_y * 160], graphics.line(screen_y), screen_y);
         }
+        graphics.mark_dirty(DRAW_OFFSET_Y, DRAW_OFFSET_Y + DRAW_HEIGHT - 1);
 
         graphics.refresh();
     }
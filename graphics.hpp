@@ -3,7 +3,6 @@
 
 #include <SPI.h>
 #include <Adafruit_GFX.h>
-#include <Adafruit_SharpMem.h>
 
 // Pin configuration for the Sharp Memory Display
 #define SHARP_SCK 18
@@ -13,9 +12,221 @@
 #define DISPLAY_WIDTH 400
 #define DISPLAY_HEIGHT 240
 
+// Sharp command bits, as sent LSB first
+#define SHARP_CMD_WRITE 0x01
+#define SHARP_CMD_VCOM 0x02
+
+// Colors accepted by every drawing call
+#define COLOR_BLACK 0
+#define COLOR_WHITE 1
+#define COLOR_INVERT 2
+
+// Image blit modes
+#define BLIT_COPY 0        // Replace the destination
+#define BLIT_TRANSPARENT 1 // Draw black pixels only
+#define BLIT_INVERT 2      // Invert the destination under black pixels
+
+#define SHARP_LINE_BYTES (DISPLAY_WIDTH / 8)
+#define SHARP_STRIDE (SHARP_LINE_BYTES + 2) // Address byte + pixels + trailer byte
+
+// Sharp Memory Display driver. The framebuffer is kept in wire format, one
+// [address][pixels][trailer] record per line, so a run of changed lines goes out
+// in a single SPI write. Pixels are packed LSB first with 1 = white. Only lines
+// marked dirty since the last refresh are sent.
+class FlywheelSharp : public Adafruit_GFX {
+public:
+    FlywheelSharp(SPIClass* spi, uint8_t cs, uint32_t frequency)
+        : Adafruit_GFX(DISPLAY_WIDTH, DISPLAY_HEIGHT), spi(spi), cs(cs), settings(frequency, LSBFIRST, SPI_MODE0) {}
+
+    void begin() {
+        pinMode(cs, OUTPUT);
+        digitalWrite(cs, LOW); // Chip select is active high
+        for (int y = 0; y < DISPLAY_HEIGHT; y++) {
+            uint8_t* record = frame + y * SHARP_STRIDE;
+            record[0] = y + 1; // Line addresses are 1-based
+            record[SHARP_STRIDE - 1] = 0;
+        }
+        fillScreen(1);
+    }
+
+    void drawPixel(int16_t x, int16_t y, uint16_t color) override {
+        if (x < 0 || y < 0 || x >= DISPLAY_WIDTH || y >= DISPLAY_HEIGHT) return;
+        apply(line(y)[x >> 3], 1 << (x & 7), color);
+        mark_dirty(y, y);
+    }
+
+    void fillScreen(uint16_t color) override {
+        for (int y = 0; y < DISPLAY_HEIGHT; y++) {
+            fill_bytes(line(y), SHARP_LINE_BYTES, color);
+        }
+        mark_dirty(0, DISPLAY_HEIGHT - 1);
+    }
+
+    // Adafruit_GFX routes text, rects and its own shapes through these
+    void drawFastHLine(int16_t x, int16_t y, int16_t w, uint16_t color) override {
+        if (w <= 0) return;
+        fill_span(x, x + w - 1, y, color);
+    }
+
+    void drawFastVLine(int16_t x, int16_t y, int16_t h, uint16_t color) override {
+        if (h <= 0) return;
+        fill_column(x, y, y + h - 1, color);
+    }
+
+    void fillRect(int16_t x, int16_t y, int16_t w, int16_t h, uint16_t color) override {
+        if (w <= 0 || h <= 0) return;
+        for (int16_t row = max(y, (int16_t)0); row < min((int)y + h, DISPLAY_HEIGHT); row++) {
+            fill_span(x, x + w - 1, row, color);
+        }
+    }
+
+    // Set, clear or invert pixels x0..x1 of line y, a whole byte at a time where possible
+    void fill_span(int16_t x0, int16_t x1, int16_t y, uint16_t color) {
+        if (y < 0 || y >= DISPLAY_HEIGHT) return;
+        if (x0 > x1) std::swap(x0, x1);
+        x0 = max(x0, (int16_t)0);
+        x1 = min(x1, (int16_t)(DISPLAY_WIDTH - 1));
+        if (x0 > x1) return;
+
+        uint8_t* p = line(y);
+        int16_t first = x0 >> 3;
+        int16_t last = x1 >> 3;
+        uint8_t firstMask = 0xFF << (x0 & 7);
+        uint8_t lastMask = 0xFF >> (7 - (x1 & 7));
+        if (first == last) {
+            apply(p[first], firstMask & lastMask, color);
+        } else {
+            apply(p[first], firstMask, color);
+            fill_bytes(p + first + 1, last - first - 1, color);
+            apply(p[last], lastMask, color);
+        }
+        mark_dirty(y, y);
+    }
+
+    // Set, clear or invert column x of lines y0..y1
+    void fill_column(int16_t x, int16_t y0, int16_t y1, uint16_t color) {
+        if (x < 0 || x >= DISPLAY_WIDTH) return;
+        if (y0 > y1) std::swap(y0, y1);
+        y0 = max(y0, (int16_t)0);
+        y1 = min(y1, (int16_t)(DISPLAY_HEIGHT - 1));
+        uint8_t mask = 1 << (x & 7);
+        for (int16_t y = y0; y <= y1; y++) {
+            apply(line(y)[x >> 3], mask, color);
+        }
+        mark_dirty(y0, y1);
+    }
+
+    // Packed pixels of line y
+    uint8_t* line(int16_t y) {
+        return frame + y * SHARP_STRIDE + 1;
+    }
+
+    // Queue lines y0..y1 (inclusive) for the next refresh
+    void mark_dirty(int16_t y0, int16_t y1) {
+        y0 = max(y0, (int16_t)0);
+        y1 = min(y1, (int16_t)(DISPLAY_HEIGHT - 1));
+        for (int16_t y = y0; y <= y1; y++) {
+            dirty[y >> 5] |= 1u << (y & 31);
+        }
+    }
+
+    bool is_dirty(int16_t y) const {
+        return dirty[y >> 5] & (1u << (y & 31));
+    }
+
+    // Send dirty lines. VCOM is toggled on every call, so call at least once a second.
+    void refresh() {
+        spi->beginTransaction(settings);
+        digitalWrite(cs, HIGH);
+        uint8_t command = vcom;
+        int y = 0;
+        while (y < DISPLAY_HEIGHT && !is_dirty(y)) y++;
+        if (y < DISPLAY_HEIGHT) command |= SHARP_CMD_WRITE;
+        spi->write(command);
+
+        while (y < DISPLAY_HEIGHT) {
+            int first = y;
+            while (y < DISPLAY_HEIGHT && is_dirty(y)) y++;
+            spi->writeBytes(frame + first * SHARP_STRIDE, (y - first) * SHARP_STRIDE);
+            while (y < DISPLAY_HEIGHT && !is_dirty(y)) y++;
+        }
+        spi->write(0x00);
+        digitalWrite(cs, LOW);
+        spi->endTransaction();
+
+        vcom ^= SHARP_CMD_VCOM;
+        memset(dirty, 0, sizeof(dirty));
+    }
+
+    // Copy a packed image (LSB first, 1 = white) to (x, y), clipped to the screen.
+    // Each destination byte is assembled from two source bytes with one shift.
+    void blit(const uint8_t* pixels, uint16_t stride, int16_t w, int16_t h, int16_t x, int16_t y, uint8_t mode) {
+        int16_t sx0 = max(0, -(int)x);
+        int16_t sx1 = min((int)w, DISPLAY_WIDTH - x);
+        int16_t sy0 = max(0, -(int)y);
+        int16_t sy1 = min((int)h, DISPLAY_HEIGHT - y);
+        if (sx0 >= sx1 || sy0 >= sy1) return;
+
+        int16_t first = (x + sx0) >> 3;
+        int16_t last = (x + sx1 - 1) >> 3;
+        uint8_t firstMask = 0xFF << ((x + sx0) & 7);
+        uint8_t lastMask = 0xFF >> (7 - ((x + sx1 - 1) & 7));
+        for (int16_t sy = sy0; sy < sy1; sy++) {
+            const uint8_t* src = pixels + sy * stride;
+            uint8_t* dst = line(y + sy);
+            for (int16_t j = first; j <= last; j++) {
+                int16_t bit = j * 8 - x; // Source bit landing on bit 0 of this byte
+                int16_t index = bit >> 3;
+                uint8_t shift = bit & 7;
+                uint8_t lo = (index >= 0 && index < stride) ? src[index] : 0xFF;
+                uint8_t hi = (shift && index + 1 < stride) ? src[index + 1] : 0xFF;
+                uint8_t value = shift ? (lo >> shift) | (hi << (8 - shift)) : lo;
+
+                uint8_t mask = 0xFF;
+                if (j == first) mask &= firstMask;
+                if (j == last) mask &= lastMask;
+                if (mode == BLIT_TRANSPARENT) {
+                    dst[j] &= value | ~mask;
+                } else if (mode == BLIT_INVERT) {
+                    dst[j] ^= ~value & mask;
+                } else {
+                    dst[j] = (dst[j] & ~mask) | (value & mask);
+                }
+            }
+        }
+        mark_dirty(y + sy0, y + sy1 - 1);
+    }
+
+private:
+    static void apply(uint8_t& byte, uint8_t mask, uint16_t color) {
+        if (color == COLOR_INVERT) {
+            byte ^= mask;
+        } else if (color) {
+            byte |= mask;
+        } else {
+            byte &= ~mask;
+        }
+    }
+
+    static void fill_bytes(uint8_t* p, int16_t count, uint16_t color) {
+        if (color == COLOR_INVERT) {
+            for (int16_t i = 0; i < count; i++) p[i] ^= 0xFF;
+        } else {
+            memset(p, color ? 0xFF : 0x00, count);
+        }
+    }
+
+    SPIClass* spi;
+    uint8_t cs;
+    SPISettings settings;
+    uint8_t vcom = SHARP_CMD_VCOM;
+    uint8_t frame[DISPLAY_HEIGHT * SHARP_STRIDE];
+    uint32_t dirty[(DISPLAY_HEIGHT + 31) / 32] = {};
+};
+
 class FlywheelGraphics {
 public:
-    FlywheelGraphics(): display(&SPI, SHARP_CS, DISPLAY_WIDTH, DISPLAY_HEIGHT, 8000000) {}
+    FlywheelGraphics(): display(&SPI, SHARP_CS, 8000000) {}
 
     void begin() {
         SPI.begin(SHARP_SCK, -1, SHARP_MOSI, SHARP_CS);
@@ -23,8 +234,7 @@ public:
         clear(1);
         display.refresh();
 
-        // Optional: log framebuffer address
-        Serial.printf("📺 SharpMem initialized. Display buffer likely in internal RAM.\n");
+        Serial.printf("📺 SharpMem initialized. Framebuffer at %p.\n", display.line(0));
     }
 
     void clear(uint8_t color) {
@@ -54,8 +264,174 @@ public:
         refresh();
     }
 
+    // Primitives. Every shape is rasterized as horizontal spans that touch each
+    // pixel exactly once, so COLOR_INVERT outlines have no doubled-up pixels.
+    // Lines and rects take full-width coordinates from Lua and clip before narrowing.
+    void hline(int32_t x, int32_t y, int32_t w, uint8_t color) {
+        int16_t x0, x1;
+        if (y < 0 || y >= DISPLAY_HEIGHT || !clip_range(x, w, DISPLAY_WIDTH, x0, x1)) return;
+        display.fill_span(x0, x1, y, color);
+    }
+
+    void vline(int32_t x, int32_t y, int32_t h, uint8_t color) {
+        int16_t y0, y1;
+        if (x < 0 || x >= DISPLAY_WIDTH || !clip_range(y, h, DISPLAY_HEIGHT, y0, y1)) return;
+        display.fill_column(x, y0, y1, color);
+    }
+
+    void fillRect(int32_t x, int32_t y, int32_t w, int32_t h, uint8_t color) {
+        int16_t x0, x1, y0, y1;
+        if (!clip_range(x, w, DISPLAY_WIDTH, x0, x1) || !clip_range(y, h, DISPLAY_HEIGHT, y0, y1)) return;
+        for (int16_t row = y0; row <= y1; row++) {
+            display.fill_span(x0, x1, row, color);
+        }
+    }
+
+    void drawRect(int32_t x, int32_t y, int32_t w, int32_t h, uint8_t color) {
+        if (w <= 0 || h <= 0 || x >= DISPLAY_WIDTH || y >= DISPLAY_HEIGHT) return;
+        int32_t right = (int32_t)min((int64_t)x + w - 1, (int64_t)INT32_MAX);
+        int32_t bottom = (int32_t)min((int64_t)y + h - 1, (int64_t)INT32_MAX);
+        hline(x, y, w, color);
+        if (h > 1) hline(x, bottom, w, color);
+        // Sides between the top and bottom edges, so corners are only touched once
+        vline(x, y + 1, h - 2, color);
+        if (w > 1) vline(right, y + 1, h - 2, color);
+    }
+
+    // Bresenham, emitting each row's run of pixels as one span
+    void drawLine(int16_t x0, int16_t y0, int16_t x1, int16_t y1, uint8_t color) {
+        if (y0 > y1) {
+            std::swap(x0, x1);
+            std::swap(y0, y1);
+        }
+        int16_t dx = abs(x1 - x0);
+        int16_t dy = y1 - y0;
+        int16_t step = x0 < x1 ? 1 : -1;
+        int32_t err = dx - dy;
+        int16_t runStart = x0;
+        while (x0 != x1 || y0 != y1) {
+            int32_t e2 = 2 * err;
+            if (e2 > -dy) {
+                err -= dy;
+                x0 += step;
+            }
+            if (e2 < dx) {
+                // Moving to the next row: flush this row's run first
+                err += dx;
+                int16_t runEnd = (e2 > -dy) ? x0 - step : x0;
+                display.fill_span(runStart, runEnd, y0, color);
+                y0++;
+                runStart = x0;
+            }
+        }
+        display.fill_span(runStart, x1, y1, color);
+    }
+
+    void fillCircle(int16_t cx, int16_t cy, int16_t r, uint8_t color) {
+        if (r < 0) return;
+        for (int d = max(-(int)r, -(int)cy); d <= min((int)r, DISPLAY_HEIGHT - 1 - cy); d++) {
+            int16_t w = circle_width(r, abs(d));
+            display.fill_span(cx - w, cx + w, cy + d, color);
+        }
+    }
+
+    void drawCircle(int16_t cx, int16_t cy, int16_t r, uint8_t color) {
+        if (r < 0) return;
+        for (int d = max(-(int)r, -(int)cy); d <= min((int)r, DISPLAY_HEIGHT - 1 - cy); d++) {
+            int16_t w = circle_width(r, abs(d));
+            int16_t inner = ring_inner(r, abs(d));
+            span_pair(cx - w, cx - inner, cx + inner, cx + w, cy + d, color);
+        }
+    }
+
+    void fillRoundRect(int16_t x, int16_t y, int16_t w, int16_t h, int16_t r, uint8_t color) {
+        if (w <= 0 || h <= 0) return;
+        r = max((int16_t)0, min(r, (int16_t)((min(w, h) - 1) / 2)));
+        for (int row = max(0, -(int)y); row < min((int)h, DISPLAY_HEIGHT - y); row++) {
+            int16_t inset = r - circle_width(r, corner_distance(row, h, r));
+            display.fill_span(x + inset, x + w - 1 - inset, y + row, color);
+        }
+    }
+
+    void drawRoundRect(int16_t x, int16_t y, int16_t w, int16_t h, int16_t r, uint8_t color) {
+        if (w <= 0 || h <= 0) return;
+        r = max((int16_t)0, min(r, (int16_t)((min(w, h) - 1) / 2)));
+        if (r == 0) {
+            drawRect(x, y, w, h, color);
+            return;
+        }
+        int16_t left = x + r;          // Centre column of the left corners
+        int16_t right = x + w - 1 - r; // Centre column of the right corners
+        for (int row = max(0, -(int)y); row < min((int)h, DISPLAY_HEIGHT - y); row++) {
+            int16_t d = corner_distance(row, h, r);
+            int16_t outer = circle_width(r, d);
+            if (d == r) {
+                display.fill_span(left - outer, right + outer, y + row, color); // Top or bottom edge
+            } else {
+                int16_t inner = ring_inner(r, d);
+                span_pair(left - outer, left - inner, right + inner, right + outer, y + row, color);
+            }
+        }
+    }
+
+    // Draw a packed 1-bit image; see FlywheelSharp::blit
+    void drawImage(const uint8_t* pixels, uint16_t stride, int16_t w, int16_t h, int16_t x, int16_t y, uint8_t mode) {
+        display.blit(pixels, stride, w, h, x, y, mode);
+    }
+
+    // Direct access for renderers that write packed rows; pair with mark_dirty
+    uint8_t* line(int16_t y) {
+        return display.line(y);
+    }
+
+    void mark_dirty(int16_t y0, int16_t y1) {
+        display.mark_dirty(y0, y1);
+    }
+
 private:
-    Adafruit_SharpMem display;
+    FlywheelSharp display;
+
+    // Half-width of a filled circle of radius r at row offset d from its centre, -1 past the edge
+    static int16_t circle_width(int16_t r, int16_t d) {
+        if (d > r) return -1;
+        int32_t limit = (int32_t)r * r + r - (int32_t)d * d; // Pixel centres within r + 0.5
+        int32_t x = sqrtf(limit);
+        while (x * x > limit) x--;
+        while ((x + 1) * (x + 1) <= limit) x++;
+        return x;
+    }
+
+    // Innermost outline column at row offset d: just inside the next row's extent
+    static int16_t ring_inner(int16_t r, int16_t d) {
+        return min((int16_t)(circle_width(r, d + 1) + 1), circle_width(r, d));
+    }
+
+    // Rows into a top or bottom corner band count up to r at the edge; 0 elsewhere
+    static int16_t corner_distance(int16_t row, int16_t h, int16_t r) {
+        if (row < r) return r - row;
+        if (row > h - 1 - r) return row - (h - 1 - r);
+        return 0;
+    }
+
+    // Two spans on one row, merged if they meet so no pixel is drawn twice
+    // Clip the run start..start+length-1 to 0..limit-1; false if nothing is left
+    static bool clip_range(int32_t start, int32_t length, int32_t limit, int16_t& first, int16_t& last) {
+        if (length <= 0) return false;
+        int64_t end = (int64_t)start + length - 1;
+        if (end < 0 || start >= limit) return false;
+        first = max(start, (int32_t)0);
+        last = min(end, (int64_t)limit - 1);
+        return true;
+    }
+
+    void span_pair(int16_t l0, int16_t l1, int16_t r0, int16_t r1, int16_t y, uint8_t color) {
+        if (r0 <= l1 + 1) {
+            display.fill_span(l0, r1, y, color);
+        } else {
+            display.fill_span(l0, l1, y, color);
+            display.fill_span(r0, r1, y, color);
+        }
+    }
 };
 
 #endif
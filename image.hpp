@@ -0,0 +1,329 @@
+#ifndef FLYWHEEL_IMAGE_HPP
+#define FLYWHEEL_IMAGE_HPP
+
+#include <esp32-hal-psram.h>
+
+#include "sd.hpp"
+
+extern FlywheelSD sd;
+
+#define IMAGE_MAX_ENTRIES 32
+#define IMAGE_DEFAULT_BUDGET (1024 * 1024)
+#define IMAGE_MAX_DIMENSION 4096
+
+// A decoded image: rows packed LSB first with 1 = white, the same layout as a display line
+struct FlywheelImage {
+    uint8_t* pixels = nullptr;
+    uint16_t width = 0;
+    uint16_t height = 0;
+    uint16_t stride = 0; // Bytes per row
+};
+
+// Loads binary PBM (P4) and uncompressed 1-bit BMP files into PSRAM, one row at
+// a time straight from the card, and keeps them in an LRU cache bounded by a
+// byte budget. Images are referenced by handle; a handle goes stale once its
+// image is evicted, and loading the same path again is a cache hit while it lives.
+class FlywheelImages {
+public:
+    ~FlywheelImages() {
+        clear();
+    }
+
+    // Returns a handle, or 0 with error set
+    uint32_t load(const char* path, String& error) {
+        for (int i = 0; i < IMAGE_MAX_ENTRIES; i++) {
+            if (entries[i].image.pixels && entries[i].path == path) {
+                entries[i].lastUsed = ++tick;
+                hits++;
+                return handle_of(i);
+            }
+        }
+        misses++;
+
+        FlywheelFile file;
+        if (!file.open(sd, path, O_RDONLY)) {
+            error = "cannot open file";
+            return 0;
+        }
+
+        uint8_t magic[2];
+        if (file.read(magic, 2) != 2) {
+            error = "file too short";
+            return 0;
+        }
+        FlywheelImage image;
+        bool ok;
+        if (magic[0] == 'P' && magic[1] == '4') {
+            ok = load_pbm(file, image, error);
+        } else if (magic[0] == 'B' && magic[1] == 'M') {
+            ok = load_bmp(file, image, error);
+        } else {
+            error = "not a binary PBM or BMP file";
+            ok = false;
+        }
+        if (!ok) {
+            free(image.pixels);
+            return 0;
+        }
+
+        // Only a successful load pushes older images out of the budget
+        make_room(image.stride * image.height);
+        int slot = free_slot();
+        Entry& entry = entries[slot];
+        entry.image = image;
+        entry.path = path;
+        entry.lastUsed = ++tick;
+        entry.generation++;
+        bytesUsed += image.stride * image.height;
+        return handle_of(slot);
+    }
+
+    // The image behind handle, or nullptr if it was freed or evicted
+    const FlywheelImage* get(uint32_t handle) {
+        int slot = slot_of(handle);
+        if (slot < 0) return nullptr;
+        entries[slot].lastUsed = ++tick;
+        return &entries[slot].image;
+    }
+
+    void release(uint32_t handle) {
+        int slot = slot_of(handle);
+        if (slot >= 0) evict(slot);
+    }
+
+    void clear() {
+        for (int i = 0; i < IMAGE_MAX_ENTRIES; i++) {
+            if (entries[i].image.pixels) evict(i);
+        }
+    }
+
+    // Shrinking the budget evicts least recently used images right away
+    void set_budget(uint32_t bytes) {
+        budget = bytes;
+        make_room(0);
+    }
+
+    uint32_t get_budget() const { return budget; }
+    uint32_t bytes_used() const { return bytesUsed; }
+    uint32_t hit_count() const { return hits; }
+    uint32_t miss_count() const { return misses; }
+    uint32_t eviction_count() const { return evictions; }
+
+    uint32_t image_count() const {
+        uint32_t count = 0;
+        for (int i = 0; i < IMAGE_MAX_ENTRIES; i++) {
+            if (entries[i].image.pixels) count++;
+        }
+        return count;
+    }
+
+private:
+    struct Entry {
+        FlywheelImage image;
+        String path;
+        uint32_t lastUsed = 0;
+        uint16_t generation = 0; // Bumped on every reuse so old handles go stale
+    };
+
+    Entry entries[IMAGE_MAX_ENTRIES];
+    uint32_t budget = IMAGE_DEFAULT_BUDGET;
+    uint32_t bytesUsed = 0;
+    uint32_t tick = 0;
+    uint32_t hits = 0;
+    uint32_t misses = 0;
+    uint32_t evictions = 0;
+
+    uint32_t handle_of(int slot) const {
+        return ((uint32_t)entries[slot].generation << 8) | (slot + 1);
+    }
+
+    int slot_of(uint32_t handle) const {
+        int slot = (int)(handle & 0xFF) - 1;
+        if (slot < 0 || slot >= IMAGE_MAX_ENTRIES) return -1;
+        const Entry& entry = entries[slot];
+        if (!entry.image.pixels || entry.generation != (handle >> 8)) return -1;
+        return slot;
+    }
+
+    void evict(int slot) {
+        Entry& entry = entries[slot];
+        bytesUsed -= entry.image.stride * entry.image.height;
+        free(entry.image.pixels);
+        entry.image = FlywheelImage();
+        entry.path = "";
+        evictions++;
+    }
+
+    int least_recently_used() const {
+        int oldest = -1;
+        for (int i = 0; i < IMAGE_MAX_ENTRIES; i++) {
+            if (entries[i].image.pixels && (oldest < 0 || entries[i].lastUsed < entries[oldest].lastUsed)) {
+                oldest = i;
+            }
+        }
+        return oldest;
+    }
+
+    // Evict until need more bytes fit in the budget
+    void make_room(uint32_t need) {
+        while (bytesUsed + need > budget) {
+            int oldest = least_recently_used();
+            if (oldest < 0) break;
+            evict(oldest);
+        }
+    }
+
+    int free_slot() {
+        for (int i = 0; i < IMAGE_MAX_ENTRIES; i++) {
+            if (!entries[i].image.pixels) return i;
+        }
+        int oldest = least_recently_used();
+        evict(oldest);
+        return oldest;
+    }
+
+    // Allocate the pixel buffer for a width x height image. Cached images are
+    // only evicted if PSRAM itself is short, and only until the buffer fits.
+    bool allocate(FlywheelImage& image, int32_t width, int32_t height, String& error) {
+        if (width <= 0 || height <= 0 || width > IMAGE_MAX_DIMENSION || height > IMAGE_MAX_DIMENSION) {
+            error = "unsupported image size";
+            return false;
+        }
+        image.width = width;
+        image.height = height;
+        image.stride = (width + 7) / 8;
+        uint32_t size = image.stride * image.height;
+        if (size > budget) {
+            error = "image larger than cache budget";
+            return false;
+        }
+        image.pixels = static_cast<uint8_t*>(ps_malloc(size));
+        while (!image.pixels) {
+            int oldest = least_recently_used();
+            if (oldest < 0) break;
+            evict(oldest);
+            image.pixels = static_cast<uint8_t*>(ps_malloc(size));
+        }
+        if (!image.pixels) {
+            error = "out of PSRAM";
+            return false;
+        }
+        return true;
+    }
+
+    static uint8_t reverse_bits(uint8_t b) {
+        b = (b & 0xF0) >> 4 | (b & 0x0F) << 4;
+        b = (b & 0xCC) >> 2 | (b & 0x33) << 2;
+        b = (b & 0xAA) >> 1 | (b & 0x55) << 1;
+        return b;
+    }
+
+    // Files store the leftmost pixel in the top bit; flip to LSB first, inverting if 1 meant black
+    static void convert_row(uint8_t* row, uint16_t stride, bool invert) {
+        uint8_t flip = invert ? 0xFF : 0x00;
+        for (uint16_t i = 0; i < stride; i++) {
+            row[i] = reverse_bits(row[i]) ^ flip;
+        }
+    }
+
+    // Next whitespace-separated PBM header number, skipping # comments
+    static bool read_number(FlywheelFile& file, int32_t& value) {
+        char c;
+        do {
+            if (file.read(&c, 1) != 1) return false;
+            if (c == '#') {
+                while (c != '\n') {
+                    if (file.read(&c, 1) != 1) return false;
+                }
+            }
+        } while (isspace(c));
+
+        value = 0;
+        while (isdigit(c)) {
+            value = value * 10 + (c - '0');
+            if (value > IMAGE_MAX_DIMENSION) return false;
+            if (file.read(&c, 1) != 1) return false;
+        }
+        return isspace(c); // Exactly one whitespace byte ends the last field before the raster
+    }
+
+    bool load_pbm(FlywheelFile& file, FlywheelImage& image, String& error) {
+        int32_t width, height;
+        if (!read_number(file, width) || !read_number(file, height)) {
+            error = "bad PBM header";
+            return false;
+        }
+        if (!allocate(image, width, height, error)) return false;
+
+        for (uint16_t y = 0; y < image.height; y++) {
+            uint8_t* row = image.pixels + y * image.stride;
+            if (file.read(row, image.stride) != image.stride) {
+                error = "truncated PBM data";
+                return false;
+            }
+            convert_row(row, image.stride, true); // PBM: 1 = black
+        }
+        return true;
+    }
+
+    static uint32_t le32(const uint8_t* p) {
+        return p[0] | (p[1] << 8) | (p[2] << 16) | ((uint32_t)p[3] << 24);
+    }
+
+    bool load_bmp(FlywheelFile& file, FlywheelImage& image, String& error) {
+        // Rest of the file header, then the start of the info header
+        uint8_t header[12 + 40];
+        if (file.read(header, sizeof(header)) != sizeof(header)) {
+            error = "bad BMP header";
+            return false;
+        }
+        uint32_t dataOffset = le32(header + 8);
+        uint32_t infoSize = le32(header + 12);
+        int32_t width = le32(header + 16);
+        int32_t height = le32(header + 20);
+        uint16_t bitsPerPixel = header[26] | (header[27] << 8);
+        uint32_t compression = le32(header + 28);
+        if (infoSize < 40 || bitsPerPixel != 1 || compression != 0) {
+            error = "only uncompressed 1-bit BMP is supported";
+            return false;
+        }
+
+        // Palette follows the info header; index 1 is white if it's the brighter entry
+        uint8_t palette[8];
+        if (!file.seek(14 + infoSize) || file.read(palette, 8) != 8) {
+            error = "bad BMP palette";
+            return false;
+        }
+        uint32_t luma0 = palette[0] + palette[1] + palette[2];
+        uint32_t luma1 = palette[4] + palette[5] + palette[6];
+        bool invert = luma1 < luma0;
+
+        if (height == INT32_MIN) {
+            error = "unsupported image size"; // abs() can't represent it
+            return false;
+        }
+        bool bottomUp = height > 0;
+        height = abs(height);
+        if (!allocate(image, width, height, error)) return false;
+
+        uint32_t rowBytes = (image.stride + 3) & ~3u; // Rows are padded to 4 bytes
+        if (!file.seek(dataOffset)) {
+            error = "bad BMP data offset";
+            return false;
+        }
+        for (uint16_t i = 0; i < image.height; i++) {
+            uint16_t y = bottomUp ? image.height - 1 - i : i;
+            uint8_t* row = image.pixels + y * image.stride;
+            uint8_t padding[3];
+            if (file.read(row, image.stride) != image.stride ||
+                file.read(padding, rowBytes - image.stride) != rowBytes - image.stride) {
+                error = "truncated BMP data";
+                return false;
+            }
+            convert_row(row, image.stride, invert);
+        }
+        return true;
+    }
+};
+
+#endif
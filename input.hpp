@@ -1,6 +1,9 @@
 #ifndef FLYWHEEL_INPUT_HPP
 #define FLYWHEEL_INPUT_HPP
 
+#include <driver/gpio.h>
+#include <esp_sleep.h>
+
 class FlywheelInput {
 public:
     // Configure input pins
@@ -13,6 +16,15 @@ public:
         pinMode(16, INPUT_PULLUP); // Configure pin as input with pull-up enabled
     }
 
+    // Let any button press wake the chip from light sleep
+    void enable_wakeup() {
+        const gpio_num_t pins[] = {GPIO_NUM_4, GPIO_NUM_5, GPIO_NUM_6, GPIO_NUM_7, GPIO_NUM_15, GPIO_NUM_16};
+        for (gpio_num_t pin : pins) {
+            gpio_wakeup_enable(pin, GPIO_INTR_LOW_LEVEL);
+        }
+        esp_sleep_enable_gpio_wakeup();
+    }
+
     bool check_up() {
         return digitalRead(6) == LOW;
     }
@@ -0,0 +1,458 @@
+#ifndef FLYWHEEL_KV_HPP
+#define FLYWHEEL_KV_HPP
+
+#include <freertos/FreeRTOS.h>
+#include <freertos/semphr.h>
+#include <freertos/task.h>
+#include <esp32-hal-psram.h>
+#include <rom/crc.h>
+
+#include "sd.hpp"
+#include "power.hpp"
+
+extern FlywheelSD sd;
+extern FlywheelPower power;
+
+// Log layout: a sequence of records, each
+//   [magic u8][type u8][keyLen u8][reserved u8][valueLen u16][crc32 u32][key][value]
+// The newest record for a key wins; a tombstone record deletes it.
+#define KV_RECORD_MAGIC 0xA5
+#define KV_HEADER_SIZE 10
+#define KV_MAX_KEY 255
+#define KV_MAX_VALUE 4096
+#define KV_COMPACT_MIN_DEAD (16 * 1024)  // Don't bother compacting small logs
+#define KV_COMPACT_BATCH 32              // Slots copied per lock hold while compacting
+
+enum FlywheelKVType : uint8_t {
+    KV_TOMBSTONE = 0,
+    KV_STRING = 1,
+    KV_INTEGER = 2,
+    KV_NUMBER = 3,
+    KV_BOOLEAN = 4,
+};
+
+class FlywheelKV {
+private:
+    // Index slot, kept in PSRAM. Scalars are cached inline so reading them never touches the card.
+    struct Entry {
+        uint32_t hash;          // 0 marks an empty slot
+        uint32_t offset;        // Record position in the log
+        uint32_t compactOffset; // Record position in the compaction file, or KV_NO_OFFSET
+        uint32_t keyOffset;     // Key position in the key arena
+        uint16_t valueLen;
+        uint8_t keyLen;
+        uint8_t type;
+        uint8_t inlineValue[8];
+    };
+    static constexpr uint32_t KV_NO_OFFSET = 0xFFFFFFFF;
+
+    FlywheelFile log;
+    String logPath;
+    String compactPath;
+
+    Entry* slots = nullptr;
+    uint32_t capacity = 0;    // Always a power of two
+    uint32_t count = 0;
+    char* keys = nullptr;     // Key arena in PSRAM
+    uint32_t keysUsed = 0;
+    uint32_t keysCapacity = 0;
+
+    uint32_t logEnd = 0;      // Bytes of valid records in the log
+    uint32_t liveBytes = 0;   // Bytes of records still referenced by the index
+    uint32_t pendingBytes = 0;
+    uint32_t compactions = 0;
+    uint8_t* scratch = nullptr; // One record's worth of key and value
+
+    SemaphoreHandle_t mutex = nullptr;
+    TaskHandle_t compactTaskHandle = nullptr;
+    volatile bool compacting = false;
+    FlywheelFile compactLog;
+    uint32_t compactEnd = 0;   // Log bytes covered by the compaction snapshot
+    uint32_t compactSize = 0;  // Bytes written to the compaction file
+
+    static uint32_t hash_key(const char* key, size_t keyLen) {
+        uint32_t h = 2166136261u; // FNV-1a
+        for (size_t i = 0; i < keyLen; i++) {
+            h = (h ^ (uint8_t)key[i]) * 16777619u;
+        }
+        return h ? h : 1;
+    }
+
+    static uint32_t record_size(const Entry& e) {
+        return KV_HEADER_SIZE + e.keyLen + (e.type == KV_TOMBSTONE ? 0 : e.valueLen);
+    }
+
+    static uint32_t record_crc(const uint8_t* header, const uint8_t* body, size_t bodyLen) {
+        uint32_t crc = crc32_le(0, header, 6);
+        return crc32_le(crc, body, bodyLen);
+    }
+
+    // Find the slot holding key, or the empty slot where it would go
+    uint32_t probe(const char* key, size_t keyLen, uint32_t hash) {
+        uint32_t mask = capacity - 1;
+        for (uint32_t i = hash & mask;; i = (i + 1) & mask) {
+            Entry& e = slots[i];
+            if (e.hash == 0) return i;
+            if (e.hash == hash && e.keyLen == keyLen && memcmp(keys + e.keyOffset, key, keyLen) == 0) {
+                return i;
+            }
+        }
+    }
+
+    bool grow_index(uint32_t newCapacity) {
+        Entry* newSlots = static_cast<Entry*>(ps_calloc(newCapacity, sizeof(Entry)));
+        if (!newSlots) return false;
+
+        Entry* oldSlots = slots;
+        uint32_t oldCapacity = capacity;
+        slots = newSlots;
+        capacity = newCapacity;
+        for (uint32_t i = 0; i < oldCapacity; i++) {
+            if (oldSlots[i].hash == 0) continue;
+            uint32_t mask = capacity - 1;
+            uint32_t j = oldSlots[i].hash & mask;
+            while (slots[j].hash != 0) j = (j + 1) & mask;
+            slots[j] = oldSlots[i];
+        }
+        free(oldSlots);
+        return true;
+    }
+
+    uint32_t store_key(const char* key, size_t keyLen) {
+        if (keysUsed + keyLen > keysCapacity) {
+            uint32_t newCapacity = max(keysCapacity * 2, keysUsed + (uint32_t)keyLen + 1024);
+            char* newKeys = static_cast<char*>(ps_realloc(keys, newCapacity));
+            if (!newKeys) return KV_NO_OFFSET;
+            keys = newKeys;
+            keysCapacity = newCapacity;
+        }
+        uint32_t offset = keysUsed;
+        memcpy(keys + offset, key, keyLen);
+        keysUsed += keyLen;
+        return offset;
+    }
+
+    // Remove a slot with backward-shift deletion so probe chains stay intact
+    void erase_slot(uint32_t i) {
+        uint32_t mask = capacity - 1;
+        uint32_t j = i;
+        while (true) {
+            j = (j + 1) & mask;
+            if (slots[j].hash == 0) break;
+            uint32_t home = slots[j].hash & mask;
+            // Move j back into the hole unless its home lies cyclically in (i, j]
+            if ((j > i && (home <= i || home > j)) || (j < i && (home <= i && home > j))) {
+                slots[i] = slots[j];
+                i = j;
+            }
+        }
+        slots[i].hash = 0;
+        count--;
+    }
+
+    // Apply a record to the index; used by both appends and recovery
+    bool apply(const char* key, uint8_t keyLen, uint8_t type, const uint8_t* value, uint16_t valueLen, uint32_t offset) {
+        uint32_t hash = hash_key(key, keyLen);
+        uint32_t i = probe(key, keyLen, hash);
+        Entry& e = slots[i];
+
+        if (e.hash != 0) {
+            liveBytes -= record_size(e);
+        }
+        if (type == KV_TOMBSTONE) {
+            if (e.hash != 0) erase_slot(i);
+            return true;
+        }
+
+        if (e.hash == 0) {
+            if ((count + 1) * 10 > capacity * 7) {
+                if (!grow_index(capacity * 2)) return false;
+                return apply(key, keyLen, type, value, valueLen, offset);
+            }
+            uint32_t keyOffset = store_key(key, keyLen);
+            if (keyOffset == KV_NO_OFFSET) return false;
+            e.hash = hash;
+            e.keyOffset = keyOffset;
+            e.keyLen = keyLen;
+            count++;
+        }
+
+        e.offset = offset;
+        e.compactOffset = KV_NO_OFFSET;
+        e.type = type;
+        e.valueLen = valueLen;
+        memset(e.inlineValue, 0, sizeof(e.inlineValue));
+        if (type != KV_STRING) {
+            memcpy(e.inlineValue, value, min((size_t)valueLen, sizeof(e.inlineValue)));
+        }
+        liveBytes += record_size(e);
+        return true;
+    }
+
+    bool append(const char* key, uint8_t keyLen, uint8_t type, const void* value, uint16_t valueLen) {
+        uint8_t header[KV_HEADER_SIZE];
+        header[0] = KV_RECORD_MAGIC;
+        header[1] = type;
+        header[2] = keyLen;
+        header[3] = 0;
+        header[4] = valueLen & 0xFF;
+        header[5] = valueLen >> 8;
+
+        memcpy(scratch, key, keyLen);
+        if (valueLen) memcpy(scratch + keyLen, value, valueLen);
+        uint32_t crc = record_crc(header, scratch, keyLen + valueLen);
+        memcpy(header + 6, &crc, 4);
+
+        uint32_t offset = logEnd;
+        if (!log.seek(offset) || !log.write(header, KV_HEADER_SIZE) || !log.write(scratch, keyLen + valueLen)) {
+            return false;
+        }
+        uint32_t size = KV_HEADER_SIZE + keyLen + valueLen;
+        logEnd += size;
+        pendingBytes += size;
+        return apply(key, keyLen, type, (const uint8_t*)value, valueLen, offset);
+    }
+
+    // Rebuild the index by replaying the log, cutting off a torn tail
+    bool recover() {
+        uint32_t size = log.size();
+        uint32_t offset = 0;
+        uint8_t header[KV_HEADER_SIZE];
+
+        log.seek(0);
+        while (offset + KV_HEADER_SIZE <= size) {
+            if (log.read(header, KV_HEADER_SIZE) != KV_HEADER_SIZE || header[0] != KV_RECORD_MAGIC) break;
+            uint8_t type = header[1];
+            uint8_t keyLen = header[2];
+            uint16_t valueLen = header[4] | (header[5] << 8);
+            uint32_t crc;
+            memcpy(&crc, header + 6, 4);
+            if (valueLen > KV_MAX_VALUE || offset + KV_HEADER_SIZE + keyLen + valueLen > size) break;
+            if (log.read(scratch, keyLen + valueLen) != (size_t)(keyLen + valueLen)) break;
+            if (record_crc(header, scratch, keyLen + valueLen) != crc) break;
+
+            if (!apply((const char*)scratch, keyLen, type, scratch + keyLen, valueLen, offset)) {
+                Serial.println("KV: out of memory while rebuilding index");
+                return false;
+            }
+            offset += KV_HEADER_SIZE + keyLen + valueLen;
+        }
+
+        logEnd = offset;
+        if (offset < size) {
+            Serial.printf("KV: discarding %u bytes of torn log tail\n", size - offset);
+            log.seek(offset);
+            log.truncate();
+            log.flush();
+        }
+        return true;
+    }
+
+    // Copy one record from the log into the compaction file
+    bool copy_record(Entry& e) {
+        uint32_t size = record_size(e);
+        if (!log.seek(e.offset) || log.read(scratch, size) != size) return false;
+        if (!compactLog.write(scratch, size)) return false;
+        e.compactOffset = compactSize;
+        compactSize += size;
+        return true;
+    }
+
+    static void compact_task(void* parameter) {
+        FlywheelKV* kv = static_cast<FlywheelKV*>(parameter);
+        kv->run_compaction();
+        kv->compactTaskHandle = nullptr;
+        vTaskDelete(nullptr);
+    }
+
+    // Copy live records to a fresh log in small batches so foreground sets keep
+    // running, then swap the files under the lock. Records appended while we
+    // worked are carried over verbatim from the old log's tail.
+    void run_compaction() {
+        FlywheelPower::AwakeHold awake(power); // Light sleep mid-transfer would stall the card
+        xSemaphoreTake(mutex, portMAX_DELAY);
+        compactEnd = logEnd;
+        compactSize = 0;
+        bool ok = compactLog.open(sd, compactPath.c_str(), O_RDWR | O_CREAT | O_TRUNC, logEnd);
+        for (uint32_t i = 0; i < capacity; i++) slots[i].compactOffset = KV_NO_OFFSET;
+        xSemaphoreGive(mutex);
+
+        for (uint32_t start = 0; ok; start += KV_COMPACT_BATCH) {
+            xSemaphoreTake(mutex, portMAX_DELAY);
+            bool done = start >= capacity;
+            for (uint32_t i = start; !done && ok && i < min(start + KV_COMPACT_BATCH, capacity); i++) {
+                Entry& e = slots[i];
+                if (e.hash != 0 && e.offset < compactEnd && e.compactOffset == KV_NO_OFFSET) {
+                    ok = copy_record(e);
+                }
+            }
+            xSemaphoreGive(mutex);
+            if (done) break;
+            vTaskDelay(1);
+        }
+
+        xSemaphoreTake(mutex, portMAX_DELAY);
+        // Pick up anything the batches missed because the index was resized
+        for (uint32_t i = 0; ok && i < capacity; i++) {
+            Entry& e = slots[i];
+            if (e.hash != 0 && e.offset < compactEnd && e.compactOffset == KV_NO_OFFSET) {
+                ok = copy_record(e);
+            }
+        }
+
+        // Carry over the tail written since the snapshot
+        uint32_t tailBase = compactSize;
+        for (uint32_t pos = compactEnd; ok && pos < logEnd;) {
+            uint32_t chunk = min(logEnd - pos, (uint32_t)(KV_MAX_KEY + KV_MAX_VALUE));
+            ok = log.seek(pos) && log.read(scratch, chunk) == chunk && compactLog.write(scratch, chunk);
+            pos += chunk;
+            compactSize += chunk;
+        }
+        // Cut the preallocated tail before swapping so stale bytes can't replay as records on the next boot
+        ok = ok && compactLog.seek(compactSize) && compactLog.truncate() && compactLog.flush();
+        compactLog.close();
+
+        if (ok) {
+            log.close();
+            if (!sd.remove(logPath.c_str())) {
+                ok = false;
+            } else if (!sd.rename(compactPath.c_str(), logPath.c_str())) {
+                // The compacted copy is complete; run from it and let begin() fix the name on next boot
+                String oldPath = logPath;
+                logPath = compactPath;
+                compactPath = oldPath;
+            }
+            log.open(sd, logPath.c_str(), O_RDWR);
+        }
+        if (!ok) {
+            sd.remove(compactPath.c_str());
+        }
+
+        if (ok) {
+            // Point the index at the new file and rebuild the key arena
+            char* oldKeys = keys;
+            keys = nullptr;
+            keysUsed = keysCapacity = 0;
+            for (uint32_t i = 0; i < capacity; i++) {
+                Entry& e = slots[i];
+                if (e.hash == 0) continue;
+                e.offset = e.offset < compactEnd ? e.compactOffset : e.offset - compactEnd + tailBase;
+                e.keyOffset = store_key(oldKeys + e.keyOffset, e.keyLen);
+            }
+            free(oldKeys);
+            logEnd = compactSize;
+            compactions++;
+        } else {
+            Serial.println("KV: compaction failed, keeping old log");
+        }
+        pendingBytes = 0;
+        compacting = false;
+        xSemaphoreGive(mutex);
+    }
+
+public:
+    // Open (or create) the store and rebuild its index from the log
+    bool begin(const char* path = "/flywheel.kv") {
+        if (!sd.is_initialized() || !psramFound()) return false;
+
+        logPath = path;
+        compactPath = logPath + ".tmp";
+        if (!mutex) mutex = xSemaphoreCreateMutex();
+        if (!scratch) scratch = static_cast<uint8_t*>(ps_malloc(KV_MAX_KEY + KV_MAX_VALUE));
+        if (!scratch || (!slots && !grow_index(256))) return false;
+
+        // A crash mid-swap can leave only the compacted copy behind
+        if (sd.exists(compactPath.c_str())) {
+            if (sd.exists(logPath.c_str())) {
+                sd.remove(compactPath.c_str());
+            } else {
+                sd.rename(compactPath.c_str(), logPath.c_str());
+            }
+        }
+
+        if (!log.open(sd, logPath.c_str(), O_RDWR | O_CREAT)) {
+            Serial.println("KV: failed to open log");
+            return false;
+        }
+
+        uint32_t start = millis();
+        if (!recover()) return false;
+        Serial.printf("KV: %u keys recovered in %u ms\n", count, millis() - start);
+        return true;
+    }
+
+    bool is_open() {
+        return log.is_open();
+    }
+
+    // Look up a key. On success, fills type and len and copies up to capacity bytes
+    // of the value into dst; callers retry with a bigger buffer when len > capacity.
+    bool get(const char* key, size_t keyLen, uint8_t& type, void* dst, uint16_t& len, uint16_t capacity) {
+        if (!is_open() || keyLen > KV_MAX_KEY) return false;
+        xSemaphoreTake(mutex, portMAX_DELAY);
+
+        Entry& e = slots[probe(key, keyLen, hash_key(key, keyLen))];
+        bool found = e.hash != 0;
+        if (found) {
+            type = e.type;
+            len = e.valueLen;
+            if (len <= capacity) {
+                if (type != KV_STRING) {
+                    memcpy(dst, e.inlineValue, len);
+                } else {
+                    found = log.seek(e.offset + KV_HEADER_SIZE + e.keyLen) && log.read(dst, len) == len;
+                }
+            }
+        }
+
+        xSemaphoreGive(mutex);
+        return found;
+    }
+
+    // Append a new value for key; it becomes durable on the next commit()
+    bool set(const char* key, size_t keyLen, uint8_t type, const void* value, size_t valueLen) {
+        if (!is_open() || keyLen == 0 || keyLen > KV_MAX_KEY || valueLen > KV_MAX_VALUE) return false;
+        xSemaphoreTake(mutex, portMAX_DELAY);
+        bool ok = append(key, keyLen, type, value, valueLen);
+        xSemaphoreGive(mutex);
+        return ok;
+    }
+
+    bool remove(const char* key, size_t keyLen) {
+        if (!is_open() || keyLen == 0 || keyLen > KV_MAX_KEY) return false;
+        xSemaphoreTake(mutex, portMAX_DELAY);
+        bool ok = true;
+        if (slots[probe(key, keyLen, hash_key(key, keyLen))].hash != 0) {
+            ok = append(key, keyLen, KV_TOMBSTONE, nullptr, 0);
+        }
+        xSemaphoreGive(mutex);
+        return ok;
+    }
+
+    // Flush batched writes with a single sync, then compact in the background if
+    // most of the log is dead
+    bool commit() {
+        if (!is_open()) return false;
+        xSemaphoreTake(mutex, portMAX_DELAY);
+        bool ok = pendingBytes == 0 || log.flush();
+        if (ok) pendingBytes = 0;
+
+        uint32_t dead = logEnd - liveBytes;
+        if (ok && !compacting && dead > KV_COMPACT_MIN_DEAD && dead > liveBytes) {
+            compacting = true;
+            if (xTaskCreatePinnedToCore(compact_task, "KVCompact", 4096, this, 0, &compactTaskHandle, 0) != pdPASS) {
+                compacting = false;
+            }
+        }
+        xSemaphoreGive(mutex);
+        return ok;
+    }
+
+    uint32_t key_count() const { return count; }
+    uint32_t log_bytes() const { return logEnd; }
+    uint32_t live_bytes() const { return liveBytes; }
+    uint32_t compaction_count() const { return compactions; }
+    bool is_compacting() const { return compacting; }
+};
+
+#endif
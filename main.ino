@@ -6,14 +6,23 @@
 #include "sd.hpp"
 #include "input.hpp"
 #include "wireless.hpp"
+#include "kv.hpp"
+#include "boot.hpp"
+#include "power.hpp"
+#include "image.hpp"
 #include <esp_heap_caps.h>
 
 FlywheelGraphics graphics;
 FlywheelSD sd;
 FlywheelInput input;
 FlywheelWireless wireless;
+FlywheelKV kv;
+FlywheelBoot boot;
+FlywheelPower power;
+FlywheelImages images;
 
 void setup() {
+  boot.mark("setup");
   psramInit();
 
   // Config power pins
@@ -30,31 +39,38 @@ void setup() {
       delay(100);
     }
   }
-  delay(1000);
+
+  // Storage comes up on core 0 while the display and Lua come up here; not in safe mode,
+  // so a held A never mounts the card or lets KV recovery touch the log
+  boot.start_storage("init.lua");
+  input.enable_wakeup();
+  power.begin();
 
   // display splash screen
 	graphics.begin();
-	graphics.clear(1);
 	graphics.drawText(150, 100, "Flywheel", 2, 0);
 	graphics.refresh();
-  delay(500);
+  boot.mark("splash");
 
   // prepare wifi stack & sleep
   wireless.begin();
+  boot.mark("wireless_off");
 
   // setup lua interpreter
 	lua_init_interpreter();
-  graphics.drawText(100, 10, "Lua initted", 2, 0);
-  graphics.refresh();
-  delay(200);
-
-  // load and execute init file
-	sd.begin();
-	String init_file = sd.read_file("init.lua");
-  graphics.drawText(100, 170, "SD Begun and loaded", 2, 0);
-  graphics.refresh();
-  delay(200);
-	lua_exec(init_file.c_str());
+  boot.mark("lua_ready");
+
+  // execute init file once storage has caught up
+  size_t init_len;
+  const char* init_file = boot.wait_storage(init_len);
+  boot.mark("storage_joined");
+  if (init_file) {
+    lua_run_root(init_file, init_len, "=init.lua");
+    boot.release_script();
+  } else {
+    graphics.drawText(100, 170, "init.lua not found", 2, 0);
+    graphics.refresh();
+  }
 }
 
 void loop() {
@@ -11,9 +11,17 @@ extern "C" {
 #include "esp_sleep.h"
 
 
+// Flywheel Boot
+#include "boot.hpp"
+extern FlywheelBoot boot;
+bool bootFirstFrameMarked = false;
+
+
 // Flywheel Graphics
 #include "graphics.hpp"
+#include "image.hpp"
 extern FlywheelGraphics graphics;
+extern FlywheelImages images;
 
 int lua_FlywheelGraphics_clear(lua_State *L) {
     int color = luaL_checkinteger(L, 1);  // First argument: color
@@ -43,6 +51,7 @@ int lua_FlywheelGraphics_drawBitmap(lua_State *L) {
 
 int lua_FlywheelGraphics_refresh(lua_State *L) {
     graphics.refresh();
+    boot.mark_once("first_frame", bootFirstFrameMarked);
     return 0;  // No return values
 }
 
@@ -56,8 +65,168 @@ int lua_FlywheelGraphics_drawText(lua_State *L) {
     return 0;  // No return values
 }
 
+int lua_FlywheelGraphics_hline(lua_State *L) {
+    int x = luaL_checkinteger(L, 1);  // First argument: x coordinate
+    int y = luaL_checkinteger(L, 2);  // Second argument: y coordinate
+    int w = luaL_checkinteger(L, 3);  // Third argument: width
+    int color = luaL_checkinteger(L, 4);  // Fourth argument: color
+    graphics.hline(x, y, w, color);
+    return 0;  // No return values
+}
+
+int lua_FlywheelGraphics_vline(lua_State *L) {
+    int x = luaL_checkinteger(L, 1);  // First argument: x coordinate
+    int y = luaL_checkinteger(L, 2);  // Second argument: y coordinate
+    int h = luaL_checkinteger(L, 3);  // Third argument: height
+    int color = luaL_checkinteger(L, 4);  // Fourth argument: color
+    graphics.vline(x, y, h, color);
+    return 0;  // No return values
+}
+
+int lua_FlywheelGraphics_drawRect(lua_State *L) {
+    int x = luaL_checkinteger(L, 1);  // First argument: x coordinate
+    int y = luaL_checkinteger(L, 2);  // Second argument: y coordinate
+    int w = luaL_checkinteger(L, 3);  // Third argument: width
+    int h = luaL_checkinteger(L, 4);  // Fourth argument: height
+    int color = luaL_checkinteger(L, 5);  // Fifth argument: color
+    graphics.drawRect(x, y, w, h, color);
+    return 0;  // No return values
+}
+
+int lua_FlywheelGraphics_fillRect(lua_State *L) {
+    int x = luaL_checkinteger(L, 1);  // First argument: x coordinate
+    int y = luaL_checkinteger(L, 2);  // Second argument: y coordinate
+    int w = luaL_checkinteger(L, 3);  // Third argument: width
+    int h = luaL_checkinteger(L, 4);  // Fourth argument: height
+    int color = luaL_checkinteger(L, 5);  // Fifth argument: color
+    graphics.fillRect(x, y, w, h, color);
+    return 0;  // No return values
+}
+
+int lua_FlywheelGraphics_drawLine(lua_State *L) {
+    int x0 = luaL_checkinteger(L, 1);  // First argument: start x
+    int y0 = luaL_checkinteger(L, 2);  // Second argument: start y
+    int x1 = luaL_checkinteger(L, 3);  // Third argument: end x
+    int y1 = luaL_checkinteger(L, 4);  // Fourth argument: end y
+    int color = luaL_checkinteger(L, 5);  // Fifth argument: color
+    graphics.drawLine(x0, y0, x1, y1, color);
+    return 0;  // No return values
+}
+
+int lua_FlywheelGraphics_drawCircle(lua_State *L) {
+    int x = luaL_checkinteger(L, 1);  // First argument: centre x
+    int y = luaL_checkinteger(L, 2);  // Second argument: centre y
+    int r = luaL_checkinteger(L, 3);  // Third argument: radius
+    int color = luaL_checkinteger(L, 4);  // Fourth argument: color
+    graphics.drawCircle(x, y, r, color);
+    return 0;  // No return values
+}
+
+int lua_FlywheelGraphics_fillCircle(lua_State *L) {
+    int x = luaL_checkinteger(L, 1);  // First argument: centre x
+    int y = luaL_checkinteger(L, 2);  // Second argument: centre y
+    int r = luaL_checkinteger(L, 3);  // Third argument: radius
+    int color = luaL_checkinteger(L, 4);  // Fourth argument: color
+    graphics.fillCircle(x, y, r, color);
+    return 0;  // No return values
+}
+
+int lua_FlywheelGraphics_drawRoundRect(lua_State *L) {
+    int x = luaL_checkinteger(L, 1);  // First argument: x coordinate
+    int y = luaL_checkinteger(L, 2);  // Second argument: y coordinate
+    int w = luaL_checkinteger(L, 3);  // Third argument: width
+    int h = luaL_checkinteger(L, 4);  // Fourth argument: height
+    int r = luaL_checkinteger(L, 5);  // Fifth argument: corner radius
+    int color = luaL_checkinteger(L, 6);  // Sixth argument: color
+    graphics.drawRoundRect(x, y, w, h, r, color);
+    return 0;  // No return values
+}
+
+int lua_FlywheelGraphics_fillRoundRect(lua_State *L) {
+    int x = luaL_checkinteger(L, 1);  // First argument: x coordinate
+    int y = luaL_checkinteger(L, 2);  // Second argument: y coordinate
+    int w = luaL_checkinteger(L, 3);  // Third argument: width
+    int h = luaL_checkinteger(L, 4);  // Fourth argument: height
+    int r = luaL_checkinteger(L, 5);  // Fifth argument: corner radius
+    int color = luaL_checkinteger(L, 6);  // Sixth argument: color
+    graphics.fillRoundRect(x, y, w, h, r, color);
+    return 0;  // No return values
+}
+
+int lua_FlywheelGraphics_loadImage(lua_State *L) {
+    const char* path = luaL_checkstring(L, 1);  // First argument: PBM or 1-bit BMP path
+    String error;
+    uint32_t handle = images.load(path, error);
+    if (!handle) {
+        lua_pushnil(L);
+        lua_pushfstring(L, "%s: %s", path, error.c_str());
+        return 2;  // nil, error message
+    }
+    const FlywheelImage* image = images.get(handle);
+    lua_pushinteger(L, handle);
+    lua_pushinteger(L, image->width);
+    lua_pushinteger(L, image->height);
+    return 3;  // Return handle, width, height
+}
+
+static const char* const blitModeNames[] = {"copy", "transparent", "invert", NULL};
+
+int lua_FlywheelGraphics_drawImage(lua_State *L) {
+    uint32_t handle = luaL_checkinteger(L, 1);  // First argument: image handle
+    int x = luaL_checkinteger(L, 2);  // Second argument: x coordinate
+    int y = luaL_checkinteger(L, 3);  // Third argument: y coordinate
+    int mode = luaL_checkoption(L, 4, "copy", blitModeNames);  // Fourth argument: blit mode
+    const FlywheelImage* image = images.get(handle);
+    if (image) {
+        graphics.drawImage(image->pixels, image->stride, image->width, image->height, x, y, mode);
+    }
+    lua_pushboolean(L, image != nullptr);
+    return 1;  // False if the image was freed or evicted
+}
+
+int lua_FlywheelGraphics_imageSize(lua_State *L) {
+    const FlywheelImage* image = images.get(luaL_checkinteger(L, 1));  // First argument: image handle
+    if (!image) {
+        lua_pushnil(L);
+        return 1;
+    }
+    lua_pushinteger(L, image->width);
+    lua_pushinteger(L, image->height);
+    return 2;  // Return width, height
+}
+
+int lua_FlywheelGraphics_freeImage(lua_State *L) {
+    images.release(luaL_checkinteger(L, 1));  // First argument: image handle
+    return 0;  // No return values
+}
+
+int lua_FlywheelGraphics_setImageCache(lua_State *L) {
+    lua_Integer budgetKB = luaL_checkinteger(L, 1);  // First argument: PSRAM budget in KB
+    luaL_argcheck(L, budgetKB >= 0, 1, "budget must not be negative");
+    images.set_budget(budgetKB * 1024);
+    return 0;  // No return values
+}
+
+int lua_FlywheelGraphics_imageCacheStats(lua_State *L) {
+    lua_createtable(L, 0, 6);
+    lua_pushinteger(L, images.image_count());
+    lua_setfield(L, -2, "images");
+    lua_pushinteger(L, images.bytes_used());
+    lua_setfield(L, -2, "bytesUsed");
+    lua_pushinteger(L, images.get_budget());
+    lua_setfield(L, -2, "budget");
+    lua_pushinteger(L, images.hit_count());
+    lua_setfield(L, -2, "hits");
+    lua_pushinteger(L, images.miss_count());
+    lua_setfield(L, -2, "misses");
+    lua_pushinteger(L, images.eviction_count());
+    lua_setfield(L, -2, "evictions");
+    return 1;  // Return the stats table
+}
+
 int lua_FlywheelGraphics_update(lua_State *L) {
     graphics.update();
+    boot.mark_once("first_frame", bootFirstFrameMarked);
     return 0;  // No return values
 }
 
@@ -68,19 +237,457 @@ static const luaL_Reg FlywheelGraphicsLib[] = {
     {"refresh", lua_FlywheelGraphics_refresh},
     {"drawText", lua_FlywheelGraphics_drawText},
     {"update", lua_FlywheelGraphics_update},
+    {"hline", lua_FlywheelGraphics_hline},
+    {"vline", lua_FlywheelGraphics_vline},
+    {"drawRect", lua_FlywheelGraphics_drawRect},
+    {"fillRect", lua_FlywheelGraphics_fillRect},
+    {"drawLine", lua_FlywheelGraphics_drawLine},
+    {"drawCircle", lua_FlywheelGraphics_drawCircle},
+    {"fillCircle", lua_FlywheelGraphics_fillCircle},
+    {"drawRoundRect", lua_FlywheelGraphics_drawRoundRect},
+    {"fillRoundRect", lua_FlywheelGraphics_fillRoundRect},
+    {"loadImage", lua_FlywheelGraphics_loadImage},
+    {"drawImage", lua_FlywheelGraphics_drawImage},
+    {"imageSize", lua_FlywheelGraphics_imageSize},
+    {"freeImage", lua_FlywheelGraphics_freeImage},
+    {"setImageCache", lua_FlywheelGraphics_setImageCache},
+    {"imageCacheStats", lua_FlywheelGraphics_imageCacheStats},
     {NULL, NULL}  // Sentinel to mark the end of the array
 };
 
 int luaopen_FlywheelGraphics(lua_State *L) {
     luaL_newlib(L, FlywheelGraphicsLib);  // Create a new Lua table with the functions
+
+    // Color constants accepted by every drawing function
+    lua_pushinteger(L, COLOR_BLACK);
+    lua_setfield(L, -2, "BLACK");
+    lua_pushinteger(L, COLOR_WHITE);
+    lua_setfield(L, -2, "WHITE");
+    lua_pushinteger(L, COLOR_INVERT);
+    lua_setfield(L, -2, "INVERT");
     return 1;  // Return the table on the Lua stack
 }
 
 
 // Flywheel SD Card
 #include "sd.hpp"
+#include "compress.hpp"
+#include <new>
 extern FlywheelSD sd;
 
+#define SD_FILE_METATABLE "flywheel.file"
+
+static FlywheelFile* lua_FlywheelSD_checkFile(lua_State *L, int index) {
+    FlywheelFile* file = (FlywheelFile*)luaL_checkudata(L, index, SD_FILE_METATABLE);
+    if (!file->is_open()) {
+        luaL_error(L, "attempt to use a closed file");
+    }
+    return file;
+}
+
+// Read one line into a new Lua string, returns false at EOF
+static bool lua_FlywheelSD_pushLine(lua_State *L, FlywheelFile* file, bool keepNewline) {
+    luaL_Buffer b;
+    luaL_buffinit(L, &b);
+    bool found = false;
+    size_t available;
+    const uint8_t* data;
+    while ((data = file->peek(available)) != nullptr) {
+        found = true;
+        const uint8_t* newline = (const uint8_t*)memchr(data, '\n', available);
+        size_t take = newline ? (size_t)(newline - data) + 1 : available;
+        luaL_addlstring(&b, (const char*)data, (newline && !keepNewline) ? take - 1 : take);
+        file->consume(take);
+        if (newline) break;
+    }
+    luaL_pushresult(&b);
+    if (!found) {
+        lua_pop(L, 1);
+    }
+    return found;
+}
+
+int lua_FlywheelSD_open(lua_State *L) {
+    const char* path = luaL_checkstring(L, 1);  // First argument: file path
+    const char* mode = luaL_optstring(L, 2, "r");  // Second argument: mode, as in io.open
+    lua_Integer preallocate = luaL_optinteger(L, 3, 0);  // Third argument: bytes to reserve for writing
+
+    oflag_t oflag;
+    if (strcmp(mode, "r") == 0) oflag = O_RDONLY;
+    else if (strcmp(mode, "w") == 0) oflag = O_WRONLY | O_CREAT | O_TRUNC;
+    else if (strcmp(mode, "a") == 0) oflag = O_WRONLY | O_CREAT | O_APPEND;
+    else if (strcmp(mode, "r+") == 0) oflag = O_RDWR;
+    else if (strcmp(mode, "w+") == 0) oflag = O_RDWR | O_CREAT | O_TRUNC;
+    else if (strcmp(mode, "a+") == 0) oflag = O_RDWR | O_CREAT | O_APPEND;
+    else return luaL_argerror(L, 2, "invalid mode");
+
+    FlywheelFile* file = new (lua_newuserdata(L, sizeof(FlywheelFile))) FlywheelFile();
+    luaL_setmetatable(L, SD_FILE_METATABLE);
+    if (!file->open(sd, path, oflag, preallocate > 0 ? (uint32_t)preallocate : 0)) {
+        lua_pushnil(L);
+        lua_pushfstring(L, "cannot open %s", path);
+        return 2;  // nil, error message
+    }
+    return 1;  // Return the file handle
+}
+
+FlywheelLoadStats sdLoadStats; // Timing of the last sd.load()
+
+static void lua_pushLoadStats(lua_State *L, const FlywheelLoadStats& stats) {
+    lua_createtable(L, 0, 6);
+    lua_pushboolean(L, stats.compressed);
+    lua_setfield(L, -2, "compressed");
+    lua_pushinteger(L, stats.rawBytes);
+    lua_setfield(L, -2, "rawBytes");
+    lua_pushinteger(L, stats.fileBytes);
+    lua_setfield(L, -2, "fileBytes");
+    lua_pushinteger(L, stats.totalUs);
+    lua_setfield(L, -2, "totalUs");
+    lua_pushinteger(L, stats.readUs);
+    lua_setfield(L, -2, "readUs");
+    lua_pushinteger(L, stats.decodeUs);
+    lua_setfield(L, -2, "decodeUs");
+}
+
+// Read a whole file into a string, decompressing FLZ files on the fly
+int lua_FlywheelSD_load(lua_State *L) {
+    const char* path = luaL_checkstring(L, 1);  // First argument: file path
+    int64_t start = esp_timer_get_time();
+
+    uint32_t rawSize = 0;
+    if (FlywheelCompressedLoader::probe(path, rawSize)) {
+        luaL_Buffer b;
+        char* dst = luaL_buffinitsize(L, &b, rawSize);
+        FlywheelCompressedLoader loader;
+        if (!loader.load(path, (uint8_t*)dst, rawSize, sdLoadStats)) {
+            lua_pushnil(L);
+            lua_pushfstring(L, "cannot decompress %s", path);
+            return 2;  // nil, error message
+        }
+        luaL_pushresultsize(&b, rawSize);
+        return 1;  // Return the file contents
+    }
+
+    FlywheelFile file;
+    if (!file.open(sd, path, O_RDONLY)) {
+        lua_pushnil(L);
+        lua_pushfstring(L, "cannot open %s", path);
+        return 2;  // nil, error message
+    }
+    size_t size = file.size();
+    luaL_Buffer b;
+    char* dst = luaL_buffinitsize(L, &b, size);
+    size_t got = file.read(dst, size);
+    luaL_pushresultsize(&b, got);
+
+    sdLoadStats = FlywheelLoadStats();
+    sdLoadStats.rawBytes = sdLoadStats.fileBytes = got;
+    sdLoadStats.totalUs = sdLoadStats.readUs = esp_timer_get_time() - start;
+    return 1;  // Return the file contents
+}
+
+int lua_FlywheelSD_loadStats(lua_State *L) {
+    lua_pushLoadStats(L, sdLoadStats);
+    return 1;  // Return the stats table
+}
+
+int lua_FlywheelSD_exists(lua_State *L) {
+    lua_pushboolean(L, sd.exists(luaL_checkstring(L, 1)));
+    return 1;
+}
+
+int lua_FlywheelSD_size(lua_State *L) {
+    lua_pushinteger(L, sd.get_file_size(luaL_checkstring(L, 1)));
+    return 1;
+}
+
+int lua_FlywheelSD_remove(lua_State *L) {
+    lua_pushboolean(L, sd.remove(luaL_checkstring(L, 1)));
+    return 1;
+}
+
+int lua_FlywheelFile_read(lua_State *L) {
+    FlywheelFile* file = lua_FlywheelSD_checkFile(L, 1);
+
+    if (lua_type(L, 2) == LUA_TNUMBER) {
+        lua_Integer n = luaL_checkinteger(L, 2);
+        luaL_argcheck(L, n >= 0, 2, "count must not be negative");
+        luaL_Buffer b;
+        char* dst = luaL_buffinitsize(L, &b, n);
+        size_t got = file->read(dst, n);
+        luaL_pushresultsize(&b, got);
+        if (got == 0 && n > 0) {
+            lua_pop(L, 1);
+            lua_pushnil(L);  // EOF
+        }
+        return 1;
+    }
+
+    const char* format = luaL_optstring(L, 2, "l");
+    if (*format == '*') format++;  // Accept Lua 5.1 style "*l"
+    if (*format == 'a') {
+        luaL_Buffer b;
+        luaL_buffinit(L, &b);
+        size_t available;
+        const uint8_t* data;
+        while ((data = file->peek(available)) != nullptr) {
+            luaL_addlstring(&b, (const char*)data, available);
+            file->consume(available);
+        }
+        luaL_pushresult(&b);
+        return 1;
+    }
+    if (*format == 'l' || *format == 'L') {
+        if (!lua_FlywheelSD_pushLine(L, file, *format == 'L')) {
+            lua_pushnil(L);
+        }
+        return 1;
+    }
+    return luaL_argerror(L, 2, "invalid format");
+}
+
+static int lua_FlywheelFile_linesIterator(lua_State *L) {
+    FlywheelFile* file = lua_FlywheelSD_checkFile(L, lua_upvalueindex(1));
+    if (!lua_FlywheelSD_pushLine(L, file, false)) {
+        lua_pushnil(L);
+    }
+    return 1;
+}
+
+int lua_FlywheelFile_lines(lua_State *L) {
+    lua_FlywheelSD_checkFile(L, 1);
+    lua_pushvalue(L, 1);  // Keep the handle alive inside the iterator
+    lua_pushcclosure(L, lua_FlywheelFile_linesIterator, 1);
+    return 1;
+}
+
+int lua_FlywheelFile_write(lua_State *L) {
+    FlywheelFile* file = lua_FlywheelSD_checkFile(L, 1);
+    int top = lua_gettop(L);
+    for (int i = 2; i <= top; i++) {
+        size_t len;
+        const char* data = luaL_checklstring(L, i, &len);
+        if (!file->write(data, len)) {
+            lua_pushnil(L);
+            lua_pushstring(L, "write failed");
+            return 2;
+        }
+    }
+    lua_settop(L, 1);
+    return 1;  // Return the handle for chaining
+}
+
+int lua_FlywheelFile_append(lua_State *L) {
+    FlywheelFile* file = lua_FlywheelSD_checkFile(L, 1);
+    if (!file->seek_end()) {
+        lua_pushnil(L);
+        lua_pushstring(L, "seek failed");
+        return 2;
+    }
+    return lua_FlywheelFile_write(L);
+}
+
+int lua_FlywheelFile_seek(lua_State *L) {
+    static const char* const whenceNames[] = {"set", "cur", "end", NULL};
+    FlywheelFile* file = lua_FlywheelSD_checkFile(L, 1);
+    int whence = luaL_checkoption(L, 2, "cur", whenceNames);
+    lua_Integer offset = luaL_optinteger(L, 3, 0);
+
+    lua_Integer base = 0;
+    if (whence == 1) base = file->position();
+    else if (whence == 2) base = file->size();
+
+    lua_Integer target = base + offset;
+    if (target < 0 || !file->seek((uint32_t)target)) {
+        lua_pushnil(L);
+        lua_pushstring(L, "seek failed");
+        return 2;
+    }
+    lua_pushinteger(L, target);
+    return 1;  // Return the new position
+}
+
+int lua_FlywheelFile_flush(lua_State *L) {
+    FlywheelFile* file = lua_FlywheelSD_checkFile(L, 1);
+    lua_pushboolean(L, file->flush());
+    return 1;
+}
+
+int lua_FlywheelFile_size(lua_State *L) {
+    FlywheelFile* file = lua_FlywheelSD_checkFile(L, 1);
+    lua_pushinteger(L, file->size());
+    return 1;
+}
+
+int lua_FlywheelFile_close(lua_State *L) {
+    FlywheelFile* file = (FlywheelFile*)luaL_checkudata(L, 1, SD_FILE_METATABLE);
+    file->close();
+    return 0;  // No return values
+}
+
+int lua_FlywheelFile_gc(lua_State *L) {
+    FlywheelFile* file = (FlywheelFile*)luaL_checkudata(L, 1, SD_FILE_METATABLE);
+    file->~FlywheelFile();
+    return 0;
+}
+
+static const luaL_Reg FlywheelFileMethods[] = {
+    {"read", lua_FlywheelFile_read},
+    {"lines", lua_FlywheelFile_lines},
+    {"write", lua_FlywheelFile_write},
+    {"append", lua_FlywheelFile_append},
+    {"seek", lua_FlywheelFile_seek},
+    {"flush", lua_FlywheelFile_flush},
+    {"size", lua_FlywheelFile_size},
+    {"close", lua_FlywheelFile_close},
+    {NULL, NULL}
+};
+
+static const luaL_Reg FlywheelSDLib[] = {
+    {"open", lua_FlywheelSD_open},
+    {"load", lua_FlywheelSD_load},
+    {"loadStats", lua_FlywheelSD_loadStats},
+    {"exists", lua_FlywheelSD_exists},
+    {"size", lua_FlywheelSD_size},
+    {"remove", lua_FlywheelSD_remove},
+    {NULL, NULL}  // Sentinel to mark the end of the array
+};
+
+int luaopen_FlywheelSD(lua_State *L) {
+    // Metatable shared by all file handles
+    luaL_newmetatable(L, SD_FILE_METATABLE);
+    luaL_newlib(L, FlywheelFileMethods);
+    lua_setfield(L, -2, "__index");
+    lua_pushcfunction(L, lua_FlywheelFile_gc);
+    lua_setfield(L, -2, "__gc");
+    lua_pop(L, 1);
+
+    luaL_newlib(L, FlywheelSDLib);  // Create a new Lua table with the functions
+    return 1;  // Return the table on the Lua stack
+}
+
+
+// Flywheel Key-Value Store
+#include "kv.hpp"
+extern FlywheelKV kv;
+
+int lua_FlywheelKV_get(lua_State *L) {
+    size_t keyLen;
+    const char* key = luaL_checklstring(L, 1, &keyLen);  // First argument: key
+
+    uint8_t type;
+    uint16_t len;
+    char small[64];
+    if (!kv.get(key, keyLen, type, small, len, sizeof(small))) {
+        lua_pushnil(L);
+        return 1;
+    }
+
+    switch (type) {
+        case KV_INTEGER: {
+            lua_Integer value;
+            memcpy(&value, small, sizeof(value));
+            lua_pushinteger(L, value);
+            break;
+        }
+        case KV_NUMBER: {
+            lua_Number value;
+            memcpy(&value, small, sizeof(value));
+            lua_pushnumber(L, value);
+            break;
+        }
+        case KV_BOOLEAN:
+            lua_pushboolean(L, small[0]);
+            break;
+        default:
+            if (len <= sizeof(small)) {
+                lua_pushlstring(L, small, len);
+            } else {
+                // Long strings are read straight into the Lua buffer
+                luaL_Buffer b;
+                char* dst = luaL_buffinitsize(L, &b, len);
+                if (!kv.get(key, keyLen, type, dst, len, len)) {
+                    return luaL_error(L, "kv: failed to read value for %s", key);
+                }
+                luaL_pushresultsize(&b, len);
+            }
+            break;
+    }
+    return 1;  // Return the value
+}
+
+int lua_FlywheelKV_set(lua_State *L) {
+    size_t keyLen;
+    const char* key = luaL_checklstring(L, 1, &keyLen);  // First argument: key
+    bool ok;
+
+    // Second argument: value, or nil to delete
+    switch (lua_type(L, 2)) {
+        case LUA_TNONE:
+        case LUA_TNIL:
+            ok = kv.remove(key, keyLen);
+            break;
+        case LUA_TBOOLEAN: {
+            uint8_t value = lua_toboolean(L, 2);
+            ok = kv.set(key, keyLen, KV_BOOLEAN, &value, sizeof(value));
+            break;
+        }
+        case LUA_TNUMBER:
+            if (lua_isinteger(L, 2)) {
+                lua_Integer value = lua_tointeger(L, 2);
+                ok = kv.set(key, keyLen, KV_INTEGER, &value, sizeof(value));
+            } else {
+                lua_Number value = lua_tonumber(L, 2);
+                ok = kv.set(key, keyLen, KV_NUMBER, &value, sizeof(value));
+            }
+            break;
+        case LUA_TSTRING: {
+            size_t len;
+            const char* value = lua_tolstring(L, 2, &len);
+            ok = kv.set(key, keyLen, KV_STRING, value, len);
+            break;
+        }
+        default:
+            return luaL_argerror(L, 2, "expected string, number, boolean or nil");
+    }
+
+    lua_pushboolean(L, ok);
+    return 1;  // Return success
+}
+
+int lua_FlywheelKV_commit(lua_State *L) {
+    lua_pushboolean(L, kv.commit());
+    return 1;  // Return success
+}
+
+int lua_FlywheelKV_stats(lua_State *L) {
+    lua_createtable(L, 0, 5);
+    lua_pushinteger(L, kv.key_count());
+    lua_setfield(L, -2, "keys");
+    lua_pushinteger(L, kv.log_bytes());
+    lua_setfield(L, -2, "logBytes");
+    lua_pushinteger(L, kv.live_bytes());
+    lua_setfield(L, -2, "liveBytes");
+    lua_pushinteger(L, kv.compaction_count());
+    lua_setfield(L, -2, "compactions");
+    lua_pushboolean(L, kv.is_compacting());
+    lua_setfield(L, -2, "compacting");
+    return 1;  // Return the stats table
+}
+
+static const luaL_Reg FlywheelKVLib[] = {
+    {"get", lua_FlywheelKV_get},
+    {"set", lua_FlywheelKV_set},
+    {"commit", lua_FlywheelKV_commit},
+    {"stats", lua_FlywheelKV_stats},
+    {NULL, NULL}  // Sentinel to mark the end of the array
+};
+
+int luaopen_FlywheelKV(lua_State *L) {
+    luaL_newlib(L, FlywheelKVLib);  // Create a new Lua table with the functions
+    return 1;  // Return the table on the Lua stack
+}
+
 
 // Flywheel Input
 #include "input.hpp"
@@ -173,6 +780,19 @@ int lua_FlywheelGB_drawFramebuffer(lua_State *L) {
     return 0; // No return values
 }
 
+static const char* const ditherModeNames[] = {"threshold", "bayer", "temporal", NULL};
+
+int lua_FlywheelGB_setDither(lua_State *L) {
+    int mode = luaL_checkoption(L, 1, NULL, ditherModeNames);  // First argument: conversion mode name
+    emulator.set_dither_mode(static_cast<FlywheelDitherMode>(mode));
+    return 0; // No return values
+}
+
+int lua_FlywheelGB_getDither(lua_State *L) {
+    lua_pushstring(L, ditherModeNames[emulator.get_dither_mode()]);
+    return 1; // Return the mode name
+}
+
 int lua_FlywheelGB_set_input_state(lua_State *L) {
     bool up     = lua_toboolean(L, 1);
     bool down   = lua_toboolean(L, 2);
@@ -188,6 +808,57 @@ int lua_FlywheelGB_set_input_state(lua_State *L) {
     return 0; // no return values
 }
 
+int lua_FlywheelGB_getLoadStats(lua_State *L) {
+    lua_pushLoadStats(L, emulator.get_load_stats());
+    return 1;  // Return the stats table for the last loadROM
+}
+
+int lua_FlywheelGB_rewind(lua_State *L) {
+    lua_Integer steps = luaL_optinteger(L, 1, 1);  // First argument: snapshots to step back
+    luaL_argcheck(L, steps > 0, 1, "steps must be positive");
+    lua_pushinteger(L, emulator.rewind(steps));
+    return 1;  // Number of snapshots actually stepped back
+}
+
+int lua_FlywheelGB_setRewind(lua_State *L) {
+    bool enabled = lua_toboolean(L, 1);  // First argument: enable snapshot history
+    lua_Integer interval = luaL_optinteger(L, 2, REWIND_DEFAULT_INTERVAL);  // Second argument: frames between snapshots
+    lua_Integer budgetKB = luaL_optinteger(L, 3, REWIND_DEFAULT_BUDGET / 1024);  // Third argument: PSRAM budget in KB
+    luaL_argcheck(L, interval > 0, 2, "interval must be positive");
+    luaL_argcheck(L, budgetKB > 0, 3, "budget must be positive");
+    lua_pushboolean(L, emulator.configure_rewind(enabled, interval, budgetKB * 1024));
+    return 1;  // Return success
+}
+
+int lua_FlywheelGB_rewindStats(lua_State *L) {
+    const FlywheelRewind& rewind = emulator.get_rewind();
+    float frameUs = emulator.get_avg_frame_us();
+    float capturePerFrameUs = rewind.avg_capture_us() / emulator.get_rewind_interval();
+
+    lua_createtable(L, 0, 10);
+    lua_pushboolean(L, rewind.is_enabled());
+    lua_setfield(L, -2, "enabled");
+    lua_pushinteger(L, rewind.snapshot_count());
+    lua_setfield(L, -2, "snapshots");
+    lua_pushinteger(L, rewind.keyframe_count());
+    lua_setfield(L, -2, "keyframes");
+    lua_pushinteger(L, rewind.bytes_used());
+    lua_setfield(L, -2, "bytes");
+    lua_pushinteger(L, rewind.budget());
+    lua_setfield(L, -2, "budget");
+    lua_pushnumber(L, rewind.snapshot_count() * emulator.get_rewind_interval() / 60.0);
+    lua_setfield(L, -2, "seconds");
+    lua_pushnumber(L, rewind.avg_capture_us());
+    lua_setfield(L, -2, "captureUs");
+    lua_pushinteger(L, rewind.max_capture_us());
+    lua_setfield(L, -2, "captureMaxUs");
+    lua_pushnumber(L, capturePerFrameUs);
+    lua_setfield(L, -2, "capturePerFrameUs");
+    lua_pushnumber(L, frameUs);
+    lua_setfield(L, -2, "frameUs");
+    return 1;  // Return the stats table
+}
+
 static const luaL_Reg FlywheelGBLib[] = {
     {"loadROM", lua_FlywheelGB_loadROM},
     {"startEmulator", lua_FlywheelGB_startEmulator},
@@ -195,6 +866,12 @@ static const luaL_Reg FlywheelGBLib[] = {
     {"getFramebuffer", lua_FlywheelGB_getFramebuffer},
     {"drawFramebuffer", lua_FlywheelGB_drawFramebuffer},
     {"setInputState", lua_FlywheelGB_set_input_state},
+    {"getLoadStats", lua_FlywheelGB_getLoadStats},
+    {"setDither", lua_FlywheelGB_setDither},
+    {"getDither", lua_FlywheelGB_getDither},
+    {"rewind", lua_FlywheelGB_rewind},
+    {"setRewind", lua_FlywheelGB_setRewind},
+    {"rewindStats", lua_FlywheelGB_rewindStats},
     {NULL, NULL} // Sentinel to mark the end of the array
 };
 
@@ -204,7 +881,132 @@ int luaopen_FlywheelGB(lua_State *L) {
 }
 
 
+// Flywheel Wireless
+#include "wireless.hpp"
+extern FlywheelWireless wireless;
+
+int wifiCallbackRef = LUA_NOREF;       // Registry reference to the onChange callback
+lua_State *wifiCallbackState = nullptr; // Main thread of the state that owns the callback
+
+static lua_State* lua_mainThread(lua_State *L) {
+    lua_rawgeti(L, LUA_REGISTRYINDEX, LUA_RIDX_MAINTHREAD);
+    lua_State *main = lua_tothread(L, -1);
+    lua_pop(L, 1);
+    return main;
+}
+
+static void lua_FlywheelWireless_readOption(lua_State *L, int table, const char *field, uint32_t &target) {
+    lua_getfield(L, table, field);
+    if (!lua_isnil(L, -1)) {
+        target = (uint32_t)luaL_checkinteger(L, -1);
+    }
+    lua_pop(L, 1);
+}
+
+int lua_FlywheelWireless_connect(lua_State *L) {
+    const char *ssid = luaL_checkstring(L, 1);  // First argument: network name
+    const char *password = luaL_optstring(L, 2, "");  // Second argument: password
+
+    // Third argument: optional table of timeout, backoff, maxBackoff, idle (ms) and attempts (0 retries forever)
+    if (lua_istable(L, 3)) {
+        FlywheelWireless::Config config = wireless.get_config();
+        uint32_t attempts = config.maxAttempts;
+        lua_FlywheelWireless_readOption(L, 3, "timeout", config.timeoutMs);
+        lua_FlywheelWireless_readOption(L, 3, "backoff", config.backoffMs);
+        lua_FlywheelWireless_readOption(L, 3, "maxBackoff", config.maxBackoffMs);
+        lua_FlywheelWireless_readOption(L, 3, "attempts", attempts);
+        lua_FlywheelWireless_readOption(L, 3, "idle", config.idleTimeoutMs);
+        config.maxAttempts = min(attempts, (uint32_t)255);
+        wireless.configure(config);
+    }
+
+    wireless.enable(ssid, password);
+    return 0;  // Progress is reported through status() and onChange()
+}
+
+int lua_FlywheelWireless_disconnect(lua_State *L) {
+    wireless.disable();
+    return 0;  // No return values
+}
+
+int lua_FlywheelWireless_status(lua_State *L) {
+    lua_pushstring(L, FlywheelWireless::state_name(wireless.status()));
+    lua_pushinteger(L, wireless.attempts());
+    return 2;  // State name and attempts made so far
+}
+
+int lua_FlywheelWireless_isConnected(lua_State *L) {
+    lua_pushboolean(L, wireless.isConnected());
+    return 1;
+}
+
+int lua_FlywheelWireless_touch(lua_State *L) {
+    wireless.touch();
+    return 0;  // No return values
+}
+
+int lua_FlywheelWireless_setIdleTimeout(lua_State *L) {
+    FlywheelWireless::Config config = wireless.get_config();
+    config.idleTimeoutMs = (uint32_t)luaL_checkinteger(L, 1);  // First argument: ms, 0 disables
+    wireless.configure(config);
+    return 0;  // No return values
+}
+
+int lua_FlywheelWireless_onChange(lua_State *L) {
+    if (!lua_isnoneornil(L, 1)) {
+        luaL_checktype(L, 1, LUA_TFUNCTION);  // First argument: callback(status), or nil to clear
+    }
+    if (wifiCallbackState) {
+        luaL_unref(wifiCallbackState, LUA_REGISTRYINDEX, wifiCallbackRef);
+        wifiCallbackRef = LUA_NOREF;
+        wifiCallbackState = nullptr;
+    }
+    if (lua_isfunction(L, 1)) {
+        lua_pushvalue(L, 1);
+        wifiCallbackRef = luaL_ref(L, LUA_REGISTRYINDEX);
+        wifiCallbackState = lua_mainThread(L);
+    }
+    return 0;  // No return values
+}
+
+// Wi-Fi events arrive on other tasks; Lua sees them only when it calls poll()
+int lua_FlywheelWireless_poll(lua_State *L) {
+    FlywheelWiFiState changed;
+    int handled = 0;
+    bool ownsCallback = wifiCallbackState && wifiCallbackState == lua_mainThread(L);
+    while (wireless.poll_change(changed)) {
+        handled++;
+        if (!ownsCallback) continue;
+        lua_rawgeti(L, LUA_REGISTRYINDEX, wifiCallbackRef);
+        lua_pushstring(L, FlywheelWireless::state_name(changed));
+        lua_call(L, 1, 0);
+    }
+    lua_pushinteger(L, handled);
+    return 1;  // Number of state changes delivered
+}
+
+static const luaL_Reg FlywheelWirelessLib[] = {
+    {"connect", lua_FlywheelWireless_connect},
+    {"disconnect", lua_FlywheelWireless_disconnect},
+    {"status", lua_FlywheelWireless_status},
+    {"isConnected", lua_FlywheelWireless_isConnected},
+    {"touch", lua_FlywheelWireless_touch},
+    {"setIdleTimeout", lua_FlywheelWireless_setIdleTimeout},
+    {"onChange", lua_FlywheelWireless_onChange},
+    {"poll", lua_FlywheelWireless_poll},
+    {NULL, NULL}  // Sentinel to mark the end of the array
+};
+
+int luaopen_FlywheelWireless(lua_State *L) {
+    luaL_newlib(L, FlywheelWirelessLib);  // Create a new Lua table with the functions
+    return 1;  // Return the table on the Lua stack
+}
+
+
 // Power Management Lib
+#include "power.hpp"
+extern FlywheelPower power;
+
 int lua_Power_getStoredPower(lua_State *L) {
     int value = analogRead(9); // ADC pin 9
     lua_pushinteger(L, value);
@@ -248,11 +1050,59 @@ int lua_Power_sleep(lua_State *L) {
 }
 
 
+static const char* const powerPolicyNames[] = {"performance", "balanced", "powersave", NULL};
+
+int lua_Power_setPolicy(lua_State *L) {
+    int policy = luaL_checkoption(L, 1, NULL, powerPolicyNames);  // First argument: policy name
+    power.set_policy((FlywheelPowerPolicy)policy);
+    return 0; // No return values
+}
+
+int lua_Power_getPolicy(lua_State *L) {
+    lua_pushstring(L, powerPolicyNames[power.get_policy()]);
+    return 1;
+}
+
+int lua_Power_setLightSleep(lua_State *L) {
+    power.set_light_sleep(lua_toboolean(L, 1));  // First argument: allow light sleep between frames
+    return 0; // No return values
+}
+
+int lua_Power_getStats(lua_State *L) {
+    lua_createtable(L, 0, 7);
+    lua_pushinteger(L, power.get_frequency());
+    lua_setfield(L, -2, "frequency");
+    lua_pushnumber(L, power.get_utilization());
+    lua_setfield(L, -2, "utilization");
+
+    // Awake time per clock, keyed by MHz
+    lua_createtable(L, 0, POWER_FREQUENCY_COUNT);
+    for (int i = 0; i < POWER_FREQUENCY_COUNT; i++) {
+        lua_pushinteger(L, power.time_at_frequency(i));
+        lua_rawseti(L, -2, FlywheelPower::FREQUENCIES[i]);
+    }
+    lua_setfield(L, -2, "timeAt");
+
+    lua_pushinteger(L, power.get_sleep_us());
+    lua_setfield(L, -2, "sleepUs");
+    lua_pushinteger(L, power.get_sleep_count());
+    lua_setfield(L, -2, "sleeps");
+    lua_pushinteger(L, power.get_missed(POWER_CLIENT_EMULATOR));
+    lua_setfield(L, -2, "missedFrames");
+    lua_pushboolean(L, power.get_light_sleep());
+    lua_setfield(L, -2, "lightSleep");
+    return 1; // Return the stats table
+}
+
 static const luaL_Reg PowerLib[] = {
     {"getStoredPower", lua_Power_getStoredPower},
     {"getPositiveChargePower", lua_Power_getPositiveChargePower},
     {"getNegativeChargePower", lua_Power_getNegativeChargePower},
     {"sleep", lua_Power_sleep},
+    {"setPolicy", lua_Power_setPolicy},
+    {"getPolicy", lua_Power_getPolicy},
+    {"setLightSleep", lua_Power_setLightSleep},
+    {"getStats", lua_Power_getStats},
     {NULL, NULL}
 };
 
@@ -262,16 +1112,82 @@ int luaopen_PowerLib(lua_State *L) {
 }
 
 
+// Boot Timing Lib
+int lua_Boot_stages(lua_State *L) {
+    size_t count = boot.stage_count();
+    lua_createtable(L, count, 0);
+    for (size_t i = 0; i < count; i++) {
+        const FlywheelBoot::Stage& stage = boot.stage(i);
+        lua_createtable(L, 0, 3);
+        lua_pushstring(L, stage.name);
+        lua_setfield(L, -2, "name");
+        lua_pushinteger(L, stage.timestamp);
+        lua_setfield(L, -2, "us");
+        lua_pushinteger(L, stage.core);
+        lua_setfield(L, -2, "core");
+        lua_rawseti(L, -2, i + 1);
+    }
+    return 1;  // Return the list of stages in the order they finished
+}
+
+int lua_Boot_elapsed(lua_State *L) {
+    lua_pushinteger(L, esp_timer_get_time());
+    return 1;  // Microseconds since power-on
+}
+
+static const luaL_Reg BootLib[] = {
+    {"stages", lua_Boot_stages},
+    {"elapsed", lua_Boot_elapsed},
+    {NULL, NULL}
+};
+
+int luaopen_BootLib(lua_State *L) {
+    luaL_newlib(L, BootLib); // Create a new Lua table with the functions
+    return 1; // Return the table on the Lua stack
+}
+
+
 // General Lua Passthrough Methods
+// Lua only counts as idle inside sleep(), so loops must call it for light sleep to happen
 int lua_sleep(lua_State *L) {
-    int duration = luaL_checkinteger(L, 1);  // Get the duration (in milliseconds) from Lua
-    delay(duration);  // Sleep for the specified duration
+    lua_Integer duration = luaL_checkinteger(L, 1);  // Get the duration (in milliseconds) from Lua
+    // Widen before scaling, and keep the deadline clear of int64 overflow
+    uint64_t us = duration > 0 ? (uint64_t)min(duration, (lua_Integer)(INT64_MAX / 2000)) * 1000 : 0;
+    power.idle_for(POWER_CLIENT_LUA, us);  // Let the governor use the slack
     return 0;  // No return values
 }
 
 
 // Lua Core
-lua_State *L; // Global lua state
+#define LUA_MAX_APPS 8
+#define LUA_APP_DEFAULT_BUDGET (512 * 1024)
+
+// Heap accounting for one Lua state; a limit of 0 means unlimited
+struct FlywheelLuaBudget {
+    size_t used = 0;
+    size_t limit = 0;
+    size_t peak = 0;
+    uint32_t denied = 0;  // Allocations refused for going over the limit
+};
+
+// An isolated Lua state with its own globals and heap. The main chunk is compiled
+// once and runs as a coroutine, so switching away leaves it suspended and switching
+// back resumes it where it left off.
+struct FlywheelLuaApp {
+    String name;
+    lua_State *state = nullptr;
+    lua_State *thread = nullptr;  // Coroutine running the chunk, nullptr until started
+    int threadRef = LUA_NOREF;
+    int chunkRef = LUA_NOREF;     // Compiled main chunk, kept for restarts
+    int pendingArgs = 0;          // Values waiting on thread for its next resume
+    int returnTo = -1;            // App to resume when this one finishes
+    FlywheelLuaBudget budget;
+};
+
+lua_State *L; // Global lua state (the root app)
+FlywheelLuaApp luaApps[LUA_MAX_APPS]; // Slot 0 is the root app running init.lua
+int luaForeground = -1;   // App currently being resumed by the scheduler
+int luaSwitchTarget = -1; // Set by app.switch before yielding to the scheduler
 
 // Memory Allocation
 void* lua_internal_allocator(void* ud, void* ptr, size_t osize, size_t nsize) {
@@ -306,6 +1222,23 @@ void* lua_psram_allocator(void* ud, void* ptr, size_t osize, size_t nsize) {
     return new_ptr;
 }
 
+// lua_psram_allocator with the FlywheelLuaBudget passed as ud enforced
+void* lua_budget_allocator(void* ud, void* ptr, size_t osize, size_t nsize) {
+    FlywheelLuaBudget* budget = static_cast<FlywheelLuaBudget*>(ud);
+    size_t oldSize = ptr ? osize : 0;  // Without ptr, osize is a type tag
+    if (nsize > oldSize && budget->limit && budget->used - oldSize + nsize > budget->limit) {
+        budget->denied++;
+        return nullptr;  // Lua collects garbage and retries, then raises "not enough memory"
+    }
+
+    void* result = lua_psram_allocator(nullptr, ptr, osize, nsize);
+    if (result || nsize == 0) {
+        budget->used = budget->used - oldSize + nsize;
+        budget->peak = max(budget->peak, budget->used);
+    }
+    return result;
+}
+
 
 
 int lua_load_from_sd(lua_State *L) {
@@ -331,20 +1264,397 @@ int lua_load_from_sd(lua_State *L) {
 
 
 
-// Main Control Methods
-bool lua_init_interpreter() {
-    // Initialize Lua interpreter
-    L = lua_newstate(lua_psram_allocator, NULL);
-    if (L == NULL) {
+// Flywheel Apps
+int lua_open_flywheel(lua_State *L);
+
+static int lua_app_find(const char *name) {
+    for (int i = 0; i < LUA_MAX_APPS; i++) {
+        if (luaApps[i].state && luaApps[i].name == name) return i;
+    }
+    return -1;
+}
+
+// The app whose state L belongs to
+static int lua_app_of(lua_State *L) {
+    lua_State *main = lua_mainThread(L);
+    for (int i = 0; i < LUA_MAX_APPS; i++) {
+        if (luaApps[i].state == main) return i;
+    }
+    return -1;
+}
+
+// Protected, in the app's state: compile the chunk and keep it in the registry
+static int lua_app_compile(lua_State *L) {
+    const char *script = static_cast<const char *>(lua_touserdata(L, 1));
+    size_t len = lua_tointeger(L, 2);
+    const char *chunkName = static_cast<const char *>(lua_touserdata(L, 3));
+    if (luaL_loadbuffer(L, script, len, chunkName) != LUA_OK) {
+        return lua_error(L);
+    }
+    lua_pushinteger(L, luaL_ref(L, LUA_REGISTRYINDEX));
+    return 1;  // Registry reference to the chunk
+}
+
+// Protected, in the app's state: a fresh coroutine with the chunk ready to run
+static int lua_app_newThread(lua_State *L) {
+    int chunkRef = lua_tointeger(L, 1);
+    lua_State *thread = lua_newthread(L);
+    lua_rawgeti(L, LUA_REGISTRYINDEX, chunkRef);
+    lua_xmove(L, thread, 1);
+    lua_pushinteger(L, luaL_ref(L, LUA_REGISTRYINDEX));
+    return 1;  // Registry reference to the thread
+}
+
+struct FlywheelLuaTransfer {
+    lua_State *from;
+    int first;
+    int count;
+    lua_State *to;
+};
+
+// Protected, in the target's state: copy nil/boolean/number/string values across states
+static int lua_app_transferValues(lua_State *L) {
+    FlywheelLuaTransfer *transfer = static_cast<FlywheelLuaTransfer *>(lua_touserdata(L, 1));
+    luaL_checkstack(L, transfer->count, "too many values");
+    for (int i = 0; i < transfer->count; i++) {
+        int index = transfer->first + i;
+        switch (lua_type(transfer->from, index)) {
+            case LUA_TBOOLEAN:
+                lua_pushboolean(L, lua_toboolean(transfer->from, index));
+                break;
+            case LUA_TNUMBER:
+                if (lua_isinteger(transfer->from, index)) {
+                    lua_pushinteger(L, lua_tointeger(transfer->from, index));
+                } else {
+                    lua_pushnumber(L, lua_tonumber(transfer->from, index));
+                }
+                break;
+            case LUA_TSTRING: {
+                size_t len;
+                const char *str = lua_tolstring(transfer->from, index, &len);
+                lua_pushlstring(L, str, len);
+                break;
+            }
+            default:
+                lua_pushnil(L);
+                break;
+        }
+    }
+    if (!lua_checkstack(transfer->to, transfer->count)) {
+        return luaL_error(L, "stack overflow");
+    }
+    lua_xmove(L, transfer->to, transfer->count);
+    return 0;
+}
+
+// pcall the helper already pushed with its arguments onto the app's main stack; on failure error holds the message
+static bool lua_app_call(FlywheelLuaApp &app, int nargs, int nresults, String &error) {
+    if (lua_pcall(app.state, nargs, nresults, 0) == LUA_OK) return true;
+    error = lua_tostring(app.state, -1);
+    lua_pop(app.state, 1);
+    return false;
+}
+
+// Create the app's coroutine if it isn't running yet
+static bool lua_app_start(FlywheelLuaApp &app, String &error) {
+    if (app.thread) return true;
+    lua_pushcfunction(app.state, lua_app_newThread);
+    lua_pushinteger(app.state, app.chunkRef);
+    if (!lua_app_call(app, 1, 1, error)) return false;
+    app.threadRef = lua_tointeger(app.state, -1);
+    lua_pop(app.state, 1);
+    lua_rawgeti(app.state, LUA_REGISTRYINDEX, app.threadRef);
+    app.thread = lua_tothread(app.state, -1);
+    lua_pop(app.state, 1);
+    app.pendingArgs = 0;
+    return true;
+}
+
+static void lua_app_finish(FlywheelLuaApp &app) {
+    luaL_unref(app.state, LUA_REGISTRYINDEX, app.threadRef);
+    app.thread = nullptr;
+    app.threadRef = LUA_NOREF;
+    app.pendingArgs = 0;
+    lua_gc(app.state, LUA_GCCOLLECT, 0);
+}
+
+// Compile script into a new state with every Flywheel library preloaded
+static bool lua_app_create(FlywheelLuaApp &app, const char *script, size_t len, const char *chunkName, String &error) {
+    if (!app.state) {
+        app.state = lua_newstate(lua_budget_allocator, &app.budget);
+        if (!app.state) {
+            error = "not enough memory";
+            return false;
+        }
+        lua_pushcfunction(app.state, lua_open_flywheel);
+        if (!lua_app_call(app, 0, 0, error)) return false;
+    }
+
+    lua_pushcfunction(app.state, lua_app_compile);
+    lua_pushlightuserdata(app.state, const_cast<char *>(script));
+    lua_pushinteger(app.state, len);
+    lua_pushlightuserdata(app.state, const_cast<char *>(chunkName));
+    if (!lua_app_call(app, 3, 1, error)) return false;
+    app.chunkRef = lua_tointeger(app.state, -1);
+    lua_pop(app.state, 1);
+    return true;
+}
+
+static void lua_app_close(int index) {
+    FlywheelLuaApp &app = luaApps[index];
+    if (wifiCallbackState == app.state) {
+        wifiCallbackState = nullptr;
+        wifiCallbackRef = LUA_NOREF;
+    }
+    if (app.state) lua_close(app.state);
+    app = FlywheelLuaApp();
+    for (int i = 0; i < LUA_MAX_APPS; i++) {
+        if (luaApps[i].returnTo == index) luaApps[i].returnTo = 0;
+    }
+}
+
+static int lua_resume_app(FlywheelLuaApp &app, int &results) {
+#if LUA_VERSION_NUM >= 504
+    return lua_resume(app.thread, nullptr, app.pendingArgs, &results);
+#else
+    int status = lua_resume(app.thread, nullptr, app.pendingArgs);
+    results = lua_gettop(app.thread);
+    return status;
+#endif
+}
+
+// Resume apps until the chain of switches runs out. An app that finishes or
+// fails hands control back to the app that last switched to it.
+void lua_run_apps(int index) {
+    while (index >= 0 && luaApps[index].thread) {
+        FlywheelLuaApp &app = luaApps[index];
+        luaForeground = index;
+        luaSwitchTarget = -1;
+
+        int results = 0;
+        int status = lua_resume_app(app, results);
+        app.pendingArgs = 0;
+        if (status == LUA_YIELD) {
+            lua_pop(app.thread, results);
+            // A bare coroutine.yield at the top level hands control back like app.yield()
+            if (luaSwitchTarget >= 0) {
+                index = luaSwitchTarget;
+            } else if (app.returnTo >= 0) {
+                index = app.returnTo;
+            }
+        } else {
+            if (status != LUA_OK) {
+                Serial.printf("Error running Lua app %s:\n", app.name.c_str());
+                Serial.println(lua_tostring(app.thread, -1));
+            }
+            lua_app_finish(app);
+            index = app.returnTo;
+        }
+    }
+    luaForeground = -1;
+}
+
+// Suspend the calling app and resume target, passing arguments first..top along
+static int lua_app_switchTo(lua_State *L, int target, int first) {
+    // Coroutines inside an app are yieldable too, so compare against the app's own thread
+    int self = lua_app_of(L);
+    if (self < 0 || L != luaApps[self].thread || !lua_isyieldable(L)) {
+        return luaL_error(L, "apps can only switch from their main coroutine");
+    }
+    int count = max(lua_gettop(L) - first + 1, 0);
+    for (int i = first; i < first + count; i++) {
+        int type = lua_type(L, i);
+        luaL_argcheck(L, type == LUA_TNIL || type == LUA_TBOOLEAN || type == LUA_TNUMBER || type == LUA_TSTRING,
+                      i, "only nil, booleans, numbers and strings can be passed between apps");
+    }
+
+    FlywheelLuaApp &app = luaApps[target];
+    // luaL_error and lua_yield longjmp past destructors, so the String must be gone before either
+    char message[128] = "";
+    {
+        String error;
+        if (!lua_app_start(app, error)) {
+            snprintf(message, sizeof(message), "cannot start %s: %s", app.name.c_str(), error.c_str());
+        } else if (count > 0) {
+            FlywheelLuaTransfer transfer = {L, first, count, app.thread};
+            lua_pushcfunction(app.state, lua_app_transferValues);
+            lua_pushlightuserdata(app.state, &transfer);
+            if (lua_app_call(app, 1, 0, error)) {
+                app.pendingArgs += count;
+            } else {
+                snprintf(message, sizeof(message), "cannot pass values to %s: %s", app.name.c_str(), error.c_str());
+            }
+        }
+    }
+    if (message[0]) {
+        return luaL_error(L, "%s", message);
+    }
+
+    app.returnTo = self;
+    luaSwitchTarget = target;
+    return lua_yield(L, 0);  // Resumes with whatever is passed when switched back to
+}
+
+// Read path and create the app in slot. Lua errors longjmp past destructors, so
+// the file and Strings live only in here and failures come back in message.
+static bool lua_app_loadFile(int slot, const char *path, size_t budget, char *message, size_t size) {
+    FlywheelFile file;
+    if (!file.open(sd, path, O_RDONLY)) {
+        snprintf(message, size, "cannot open %s", path);
         return false;
     }
-    lua_checkstack(L, 64);  // Enough for most scripts but prevents deep recursion
+    size_t len = file.size();
+    char *script = static_cast<char *>(ps_malloc(len + 1));
+    if (!script || file.read(script, len) != len) {
+        free(script);
+        snprintf(message, size, "cannot read %s", path);
+        return false;
+    }
+    file.close();
+
+    FlywheelLuaApp &app = luaApps[slot];
+    app.budget.limit = budget;
+    String chunkName = String("@") + path;
+    String error;
+    bool created = lua_app_create(app, script, len, chunkName.c_str(), error);
+    free(script);
+    if (!created) {
+        snprintf(message, size, "%s", error.c_str());
+    }
+    return created;
+}
+
+// app.load(name, path [, budgetKB])
+int lua_AppLib_load(lua_State *L) {
+    const char *name = luaL_checkstring(L, 1);  // First argument: app name
+    const char *path = luaL_checkstring(L, 2);  // Second argument: main script path
+    lua_Integer budgetKB = luaL_optinteger(L, 3, LUA_APP_DEFAULT_BUDGET / 1024);  // Third argument: heap budget in KB, 0 for none
+    luaL_argcheck(L, budgetKB >= 0, 3, "budget must not be negative");
+    if (lua_app_find(name) >= 0) {
+        lua_pushnil(L);
+        lua_pushfstring(L, "app %s is already loaded", name);
+        return 2;  // nil, error message
+    }
+
+    int slot = -1;
+    for (int i = 1; i < LUA_MAX_APPS && slot < 0; i++) {
+        if (!luaApps[i].state) slot = i;
+    }
+    if (slot < 0) {
+        lua_pushnil(L);
+        lua_pushstring(L, "too many apps loaded");
+        return 2;  // nil, error message
+    }
+
+    char message[128];
+    if (!lua_app_loadFile(slot, path, budgetKB * 1024, message, sizeof(message))) {
+        lua_app_close(slot);
+        lua_pushnil(L);
+        lua_pushfstring(L, "%s: %s", name, message);
+        return 2;  // nil, error message
+    }
+    FlywheelLuaApp &app = luaApps[slot];
+    app.name = name;
+    lua_pushboolean(L, 1);
+    return 1;  // Return success
+}
+
+// app.switch(name, ...): suspend this app and run name, starting it if needed
+int lua_AppLib_switch(lua_State *L) {
+    const char *name = luaL_checkstring(L, 1);  // First argument: app to switch to
+    int target = lua_app_find(name);
+    if (target < 0) {
+        return luaL_error(L, "no app named %s", name);
+    }
+    if (target == lua_app_of(L)) {
+        return 0;  // Already in the foreground
+    }
+    return lua_app_switchTo(L, target, 2);
+}
+
+// app.yield(...): hand control back to the app that switched here
+int lua_AppLib_yield(lua_State *L) {
+    int target = luaApps[lua_app_of(L)].returnTo;
+    if (target < 0 || !luaApps[target].state) {
+        return luaL_error(L, "no app to return to");
+    }
+    return lua_app_switchTo(L, target, 1);
+}
+
+int lua_AppLib_unload(lua_State *L) {
+    const char *name = luaL_checkstring(L, 1);  // First argument: app name
+    int index = lua_app_find(name);
+    luaL_argcheck(L, index != 0, 1, "the root app cannot be unloaded");
+    luaL_argcheck(L, index < 0 || index != lua_app_of(L), 1, "an app cannot unload itself");
+    if (index > 0) lua_app_close(index);
+    lua_pushboolean(L, index > 0);
+    return 1;  // Whether an app was unloaded
+}
+
+int lua_AppLib_current(lua_State *L) {
+    lua_pushstring(L, luaApps[lua_app_of(L)].name.c_str());
+    return 1;  // Return the calling app's name
+}
+
+int lua_AppLib_list(lua_State *L) {
+    lua_newtable(L);
+    int n = 0;
+    for (int i = 0; i < LUA_MAX_APPS; i++) {
+        const FlywheelLuaApp &app = luaApps[i];
+        if (!app.state) continue;
+        lua_createtable(L, 0, 6);
+        lua_pushstring(L, app.name.c_str());
+        lua_setfield(L, -2, "name");
+        lua_pushstring(L, i == luaForeground ? "running" : app.thread ? "suspended" : "idle");
+        lua_setfield(L, -2, "status");
+        lua_pushinteger(L, app.budget.used);
+        lua_setfield(L, -2, "used");
+        lua_pushinteger(L, app.budget.peak);
+        lua_setfield(L, -2, "peak");
+        lua_pushinteger(L, app.budget.limit);
+        lua_setfield(L, -2, "limit");
+        lua_pushinteger(L, app.budget.denied);
+        lua_setfield(L, -2, "denied");
+        lua_rawseti(L, -2, ++n);
+    }
+    return 1;  // Array of app info tables
+}
+
+static const luaL_Reg AppLib[] = {
+    {"load", lua_AppLib_load},
+    {"switch", lua_AppLib_switch},
+    {"yield", lua_AppLib_yield},
+    {"unload", lua_AppLib_unload},
+    {"current", lua_AppLib_current},
+    {"list", lua_AppLib_list},
+    {NULL, NULL}  // Sentinel to mark the end of the array
+};
+
+int luaopen_AppLib(lua_State *L) {
+    luaL_newlib(L, AppLib);  // Create a new Lua table with the functions
+    return 1;  // Return the table on the Lua stack
+}
+
+
+
+// Main Control Methods
+
+// Protected: load the standard and Flywheel libraries into a fresh state
+int lua_open_flywheel(lua_State *L) {
     luaL_openlibs(L);  // Load Lua standard libraries
 
     // Register FlywheelGraphics library
     luaL_requiref(L, "graphics", luaopen_FlywheelGraphics, 1);
     lua_pop(L, 1);  // Remove library table from stack after registration
 
+    // Register FlywheelSD library
+    luaL_requiref(L, "sd", luaopen_FlywheelSD, 1);
+    lua_pop(L, 1);  // Remove library table from stack after registration
+
+    // Register FlywheelKV library
+    luaL_requiref(L, "kv", luaopen_FlywheelKV, 1);
+    lua_pop(L, 1);  // Remove library table from stack after registration
+
     // Register FlywheelInput library
     luaL_requiref(L, "input", luaopen_FlywheelInput, 1);
     lua_pop(L, 1);  // Remove library table from stack after registration
@@ -353,10 +1663,22 @@ bool lua_init_interpreter() {
     luaL_requiref(L, "emulator", luaopen_FlywheelGB, 1);
     lua_pop(L, 1); // Remove library table from stack after registration
 
+    // Register FlywheelWireless library
+    luaL_requiref(L, "wifi", luaopen_FlywheelWireless, 1);
+    lua_pop(L, 1); // Remove library table from stack after registration
+
     // Register Power library
     luaL_requiref(L, "power", luaopen_PowerLib, 1);
     lua_pop(L, 1); // Remove library table from stack after registration
 
+    // Register Boot library
+    luaL_requiref(L, "boot", luaopen_BootLib, 1);
+    lua_pop(L, 1); // Remove library table from stack after registration
+
+    // Register App library
+    luaL_requiref(L, "app", luaopen_AppLib, 1);
+    lua_pop(L, 1); // Remove library table from stack after registration
+
     // Register the global sleep function
     lua_pushcfunction(L, lua_sleep);
     lua_setglobal(L, "sleep");  // Make it accessible globally as "sleep"
@@ -369,14 +1691,35 @@ bool lua_init_interpreter() {
     lua_pushcfunction(L, lua_load_from_sd);  // Push your custom loader
     lua_settable(L, -3);  // package.searchers[new index] = lua_load_from_sd
     lua_pop(L, 2);  // Clean the stack (package and searchers)
+    return 0;
+}
+
+bool lua_init_interpreter() {
+    // Initialize Lua interpreter as the root app, without a budget
+    FlywheelLuaApp &root = luaApps[0];
+    root.name = "init";
+    root.state = lua_newstate(lua_budget_allocator, &root.budget);
+    L = root.state;
+    if (L == NULL) {
+        return false;
+    }
+    lua_checkstack(L, 64);  // Enough for most scripts but prevents deep recursion
+
+    String error;
+    lua_pushcfunction(L, lua_open_flywheel);
+    if (!lua_app_call(root, 0, 0, error)) {
+        Serial.println("Error loading Lua libraries:");
+        Serial.println(error);
+        return false;
+    }
 
 	// Lua init complete!
 	return true;
 }
 
-void lua_exec(const char *script) {
+void lua_exec(const char *script, size_t len, const char *name) {
     // Load and run the Lua script
-    if (luaL_loadstring(L, script) || lua_pcall(L, 0, LUA_MULTRET, 0)) {
+    if (luaL_loadbuffer(L, script, len, name) || lua_pcall(L, 0, LUA_MULTRET, 0)) {
         // Print the error message from the Lua stack
         Serial.println("Error running Lua script:");
         Serial.println(lua_tostring(L, -1));  
@@ -384,4 +1727,24 @@ void lua_exec(const char *script) {
     }
 }
 
+void lua_exec(const char *script) {
+    lua_exec(script, strlen(script), script);
+}
+
+// Run script as the root app. Returns once the root app finishes and nothing
+// hands control back to it.
+void lua_run_root(const char *script, size_t len, const char *name) {
+    FlywheelLuaApp &root = luaApps[0];
+    String error;
+    if (!lua_app_create(root, script, len, name, error) || !lua_app_start(root, error)) {
+        Serial.println("Error running Lua script:");
+        Serial.println(error);
+        return;
+    }
+    lua_run_apps(0);
+
+    // Nothing is left running Lua, so stop holding the governor awake
+    power.set_active(POWER_CLIENT_LUA, false);
+}
+
 #endif
\ No newline at end of file
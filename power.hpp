@@ -0,0 +1,286 @@
+#ifndef FLYWHEEL_POWER_HPP
+#define FLYWHEEL_POWER_HPP
+
+#include <freertos/FreeRTOS.h>
+#include <freertos/task.h>
+#include <freertos/semphr.h>
+#include <esp_sleep.h>
+#include <esp_timer.h>
+
+#define POWER_WINDOW_US 250000        // Utilization is evaluated over this window
+#define POWER_SLEEP_MIN_US 3000       // Shorter gaps aren't worth a light sleep
+#define POWER_SLEEP_MARGIN_US 700     // Wake this early to absorb wake-up latency
+#define POWER_FREQUENCY_COUNT 3
+
+enum FlywheelPowerClient : uint8_t {
+    POWER_CLIENT_EMULATOR,
+    POWER_CLIENT_LUA,
+    POWER_CLIENT_COUNT,
+};
+
+enum FlywheelPowerPolicy : uint8_t {
+    POWER_POLICY_PERFORMANCE, // Full clock, never sleeps between frames
+    POWER_POLICY_BALANCED,
+    POWER_POLICY_POWERSAVE,
+};
+
+// Things that must keep the system out of light sleep while they are active
+enum FlywheelPowerInhibit : uint8_t {
+    POWER_INHIBIT_WIFI = 1 << 0,
+};
+
+// Frame-slack governor. Clients wait out the rest of their frame through
+// idle_until(); the time between waits is their busy time. From that the
+// governor picks the lowest CPU clock that keeps utilization under the
+// policy's target, and light-sleeps the chip when every active client is
+// waiting. Light sleep stops both cores, so it only happens when nobody is busy.
+// Lua counts as busy except inside sleep(): a script or app that loops without
+// calling sleep() keeps the chip out of light sleep.
+class FlywheelPower {
+public:
+    static constexpr uint32_t FREQUENCIES[POWER_FREQUENCY_COUNT] = {80, 160, 240};
+
+    void begin() {
+        if (!frequencyMutex) {
+            frequencyMutex = xSemaphoreCreateMutex();
+        }
+        lastEvaluation = esp_timer_get_time();
+        freqSince = lastEvaluation;
+        for (int i = 0; i < POWER_CLIENT_COUNT; i++) clients[i].lastWake = lastEvaluation;
+        clients[POWER_CLIENT_LUA].active = true; // Lua always has a thread running
+        set_frequency(POWER_FREQUENCY_COUNT - 1);
+    }
+
+    void set_policy(FlywheelPowerPolicy newPolicy) {
+        policy = newPolicy;
+        if (policy == POWER_POLICY_PERFORMANCE) {
+            set_frequency(POWER_FREQUENCY_COUNT - 1);
+        }
+    }
+
+    FlywheelPowerPolicy get_policy() const {
+        return policy;
+    }
+
+    void set_light_sleep(bool enabled) {
+        lightSleep = enabled;
+    }
+
+    bool get_light_sleep() const {
+        return lightSleep;
+    }
+
+    void set_active(FlywheelPowerClient client, bool active) {
+        portENTER_CRITICAL(&lock);
+        clients[client].active = active;
+        clients[client].idleUntil = 0;
+        clients[client].lastWake = esp_timer_get_time();
+        portEXIT_CRITICAL(&lock);
+    }
+
+    void set_inhibit(FlywheelPowerInhibit reason, bool inhibit) {
+        portENTER_CRITICAL(&lock);
+        inhibitors = inhibit ? (inhibitors | reason) : (inhibitors & ~reason);
+        portEXIT_CRITICAL(&lock);
+    }
+
+    // Counted version for background work that may overlap, like SD transfers
+    void hold_awake() {
+        portENTER_CRITICAL(&lock);
+        awakeHolds++;
+        portEXIT_CRITICAL(&lock);
+    }
+
+    void release_awake() {
+        portENTER_CRITICAL(&lock);
+        if (awakeHolds) awakeHolds--;
+        portEXIT_CRITICAL(&lock);
+    }
+
+    // Keeps the chip out of light sleep for the lifetime of the object
+    class AwakeHold {
+    public:
+        explicit AwakeHold(FlywheelPower& power): power(power) { power.hold_awake(); }
+        ~AwakeHold() { power.release_awake(); }
+    private:
+        FlywheelPower& power;
+    };
+
+    // Wait until deadline (esp_timer microseconds), possibly in light sleep.
+    // Time since the client's previous wait is recorded as busy time.
+    void idle_until(FlywheelPowerClient client, int64_t deadline) {
+        int64_t now = esp_timer_get_time();
+        Client& c = clients[client];
+
+        portENTER_CRITICAL(&lock);
+        c.busyUs += now - c.lastWake;
+        c.periodUs += max(deadline, now) - c.lastWake;
+        if (now > deadline) c.missed++;
+        c.idleUntil = deadline;
+        portEXIT_CRITICAL(&lock);
+
+        if (now > deadline && policy != POWER_POLICY_PERFORMANCE) {
+            set_frequency(POWER_FREQUENCY_COUNT - 1); // Missed a frame: go to full clock right away
+        }
+        evaluate(now);
+        try_light_sleep();
+
+        // Sleep on ticks, checking the clock so a light sleep elsewhere can't stretch the wait
+        while (true) {
+            int64_t remaining = deadline - esp_timer_get_time();
+            if (remaining < 1000 * portTICK_PERIOD_MS) break; // Also covers waits that start late
+            TickType_t ticks = remaining / (1000 * portTICK_PERIOD_MS);
+            if (ticks == 0) break;
+            vTaskDelay(ticks);
+        }
+
+        portENTER_CRITICAL(&lock);
+        c.idleUntil = 0;
+        c.lastWake = esp_timer_get_time();
+        portEXIT_CRITICAL(&lock);
+    }
+
+    void idle_for(FlywheelPowerClient client, uint64_t us) {
+        idle_until(client, esp_timer_get_time() + us);
+    }
+
+    uint32_t get_frequency() const {
+        return FREQUENCIES[frequencyIndex];
+    }
+
+    float get_utilization() const {
+        return utilization;
+    }
+
+    // Microseconds spent awake at FREQUENCIES[index], including the current stretch
+    uint64_t time_at_frequency(int index) {
+        portENTER_CRITICAL(&lock);
+        uint64_t total = timeAtFrequency[index];
+        if (index == frequencyIndex) total += esp_timer_get_time() - freqSince;
+        portEXIT_CRITICAL(&lock);
+        return total;
+    }
+
+    uint64_t get_sleep_us() const { return sleepUs; }
+    uint32_t get_sleep_count() const { return sleepCount; }
+    uint32_t get_missed(FlywheelPowerClient client) const { return clients[client].missed; }
+
+private:
+    struct Client {
+        bool active = false;
+        int64_t idleUntil = 0; // Nonzero while waiting
+        int64_t lastWake = 0;
+        int64_t busyUs = 0;    // Accumulated over the current window
+        int64_t periodUs = 0;
+        uint32_t missed = 0;   // Waits that started past their deadline
+    };
+
+    Client clients[POWER_CLIENT_COUNT];
+    FlywheelPowerPolicy policy = POWER_POLICY_BALANCED;
+    bool lightSleep = true;
+    uint8_t inhibitors = 0;
+    uint32_t awakeHolds = 0;    // Outstanding hold_awake() calls
+    bool sleeping = false;
+    portMUX_TYPE lock = portMUX_INITIALIZER_UNLOCKED;
+
+    int frequencyIndex = POWER_FREQUENCY_COUNT - 1;
+    int64_t freqSince = 0;
+    uint64_t timeAtFrequency[POWER_FREQUENCY_COUNT] = {};
+    uint64_t sleepUs = 0;
+    uint32_t sleepCount = 0;
+    int64_t lastEvaluation = 0;
+    float utilization = 0;
+    SemaphoreHandle_t frequencyMutex = nullptr; // Keeps frequencyIndex and the real clock in step
+
+    // Switch to FREQUENCIES[index]; a negative index keeps the current one and just closes the stats stretch
+    void set_frequency(int index) {
+        if (frequencyMutex) xSemaphoreTake(frequencyMutex, portMAX_DELAY);
+        if (index < 0) index = frequencyIndex;
+        portENTER_CRITICAL(&lock);
+        int64_t now = esp_timer_get_time();
+        timeAtFrequency[frequencyIndex] += now - freqSince;
+        freqSince = now;
+        bool changed = index != frequencyIndex;
+        frequencyIndex = index;
+        portEXIT_CRITICAL(&lock);
+        if (changed) {
+            setCpuFrequencyMhz(FREQUENCIES[index]);
+        }
+        if (frequencyMutex) xSemaphoreGive(frequencyMutex);
+    }
+
+    // Once per window, scale the clock to the busiest client's utilization
+    void evaluate(int64_t now) {
+        portENTER_CRITICAL(&lock);
+        if (now - lastEvaluation < POWER_WINDOW_US) {
+            portEXIT_CRITICAL(&lock);
+            return;
+        }
+        lastEvaluation = now;
+
+        float busiest = 0;
+        for (int i = 0; i < POWER_CLIENT_COUNT; i++) {
+            Client& c = clients[i];
+            if (c.active && c.periodUs > 0) {
+                busiest = max(busiest, (float)c.busyUs / c.periodUs);
+            }
+            c.busyUs = 0;
+            c.periodUs = 0;
+        }
+        utilization = busiest;
+        portEXIT_CRITICAL(&lock);
+
+        if (policy == POWER_POLICY_PERFORMANCE) return;
+
+        // Busy time scales inversely with the clock; pick the slowest that stays under target
+        float target = policy == POWER_POLICY_POWERSAVE ? 0.9f : 0.7f;
+        float cycles = busiest * FREQUENCIES[frequencyIndex];
+        int index = POWER_FREQUENCY_COUNT - 1;
+        for (int i = 0; i < POWER_FREQUENCY_COUNT; i++) {
+            if (cycles / FREQUENCIES[i] <= target) {
+                index = i;
+                break;
+            }
+        }
+        set_frequency(index);
+    }
+
+    // Light sleep until the earliest deadline if every active client is waiting
+    void try_light_sleep() {
+        if (!lightSleep || policy == POWER_POLICY_PERFORMANCE) return;
+
+        int64_t now = esp_timer_get_time();
+        int64_t wake = INT64_MAX;
+        portENTER_CRITICAL(&lock);
+        bool allIdle = !sleeping && !inhibitors && !awakeHolds;
+        for (int i = 0; i < POWER_CLIENT_COUNT && allIdle; i++) {
+            if (!clients[i].active) continue;
+            if (clients[i].idleUntil == 0) allIdle = false;
+            else wake = min(wake, clients[i].idleUntil);
+        }
+        bool sleepNow = allIdle && wake != INT64_MAX && wake - now >= POWER_SLEEP_MIN_US;
+        if (sleepNow) sleeping = true;
+        portEXIT_CRITICAL(&lock);
+        if (!sleepNow) return;
+
+        set_frequency(-1); // Close the awake stretch for the stats
+        esp_sleep_enable_timer_wakeup(wake - now - POWER_SLEEP_MARGIN_US);
+        esp_light_sleep_start();
+        int64_t woke = esp_timer_get_time();
+
+        // The ADC loses its configuration across light sleep
+        analogReadResolution(12);
+        analogSetPinAttenuation(9, ADC_11db);
+
+        portENTER_CRITICAL(&lock);
+        sleepUs += woke - now;
+        sleepCount++;
+        freqSince = woke;
+        sleeping = false;
+        portEXIT_CRITICAL(&lock);
+    }
+};
+
+constexpr uint32_t FlywheelPower::FREQUENCIES[POWER_FREQUENCY_COUNT];
+
+#endif
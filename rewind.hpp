@@ -0,0 +1,250 @@
+#ifndef FLYWHEEL_REWIND_HPP
+#define FLYWHEEL_REWIND_HPP
+
+#include <esp_timer.h>
+#include <esp32-hal-psram.h>
+
+#define REWIND_MAX_RECORDS 512
+#define REWIND_DEFAULT_BUDGET (1024 * 1024)
+#define REWIND_DEFAULT_INTERVAL 10 // Frames between snapshots
+#define REWIND_KEYFRAME_EVERY 8    // Snapshots per keyframe group
+
+// Ring of emulator snapshots in a fixed PSRAM arena. Each group starts with a
+// raw keyframe; the rest of the group is stored as the XOR against that
+// keyframe, run-length encoded as [zero words u16][literal words u16][literals...].
+// Snapshots are evicted a whole group at a time, oldest first.
+class FlywheelRewind {
+private:
+    struct Record {
+        uint32_t offset; // Position in the arena
+        uint32_t size;   // Bytes used in the arena
+        uint16_t group;  // Position within the keyframe group, 0 for the keyframe
+    };
+
+    uint8_t* arena = nullptr;
+    uint32_t arenaSize = 0;
+    uint32_t writePos = 0;
+    uint32_t stateSize = 0;
+
+    Record records[REWIND_MAX_RECORDS];
+    uint32_t oldest = 0;     // Index of the oldest record
+    uint32_t count = 0;
+    uint32_t bytesUsed = 0;
+    uint32_t keyframes = 0;
+
+    // Capture timing
+    uint32_t lastCaptureUs = 0;
+    uint32_t maxCaptureUs = 0;
+    float avgCaptureUs = 0;
+
+    Record& record(uint32_t age) { // age 0 = oldest
+        return records[(oldest + age) % REWIND_MAX_RECORDS];
+    }
+
+    Record& newest() {
+        return record(count - 1);
+    }
+
+    // Drop the oldest keyframe and every delta that depends on it
+    void evict_group() {
+        do {
+            Record& r = record(0);
+            bytesUsed -= r.size;
+            if (r.group == 0) keyframes--;
+            oldest = (oldest + 1) % REWIND_MAX_RECORDS;
+            count--;
+        } while (count > 0 && record(0).group != 0);
+    }
+
+    // Make room for need contiguous bytes at writePos
+    void reserve(uint32_t need) {
+        if (count == REWIND_MAX_RECORDS) {
+            evict_group();
+        }
+        if (writePos + need > arenaSize) {
+            // Wrap: everything past the write position is older than what sits at the start
+            while (count > 0 && record(0).offset >= writePos) evict_group();
+            writePos = 0;
+        }
+        while (count > 0 && record(0).offset >= writePos && record(0).offset < writePos + need) {
+            evict_group();
+        }
+    }
+
+    uint32_t load_word(const uint8_t* src, uint32_t word) {
+        uint32_t value = 0;
+        uint32_t offset = word * 4;
+        memcpy(&value, src + offset, min((uint32_t)4, stateSize - offset));
+        return value;
+    }
+
+    uint32_t word_count() const {
+        return (stateSize + 3) / 4;
+    }
+
+    // Keyframes are padded to whole words so every record stays word aligned
+    uint32_t keyframe_size() const {
+        return word_count() * 4;
+    }
+
+    // Worst case: every other word differs, one 4-byte token per literal
+    uint32_t max_delta_size() const {
+        return word_count() * 8 + 4;
+    }
+
+    uint32_t encode_delta(const uint8_t* state, const uint8_t* keyframe, uint8_t* out) {
+        uint32_t words = word_count();
+        uint8_t* cursor = out;
+        uint32_t i = 0;
+        while (i < words) {
+            uint16_t zeros = 0;
+            while (i < words && zeros < 0xFFFF && load_word(state, i) == load_word(keyframe, i)) {
+                zeros++;
+                i++;
+            }
+            uint8_t* token = cursor;
+            cursor += 4;
+            uint16_t literals = 0;
+            while (i < words && literals < 0xFFFF) {
+                uint32_t diff = load_word(state, i) ^ load_word(keyframe, i);
+                if (diff == 0) break;
+                memcpy(cursor, &diff, 4);
+                cursor += 4;
+                literals++;
+                i++;
+            }
+            uint16_t header[2] = {zeros, literals};
+            memcpy(token, header, 4);
+        }
+        return cursor - out;
+    }
+
+    void decode_delta(const uint8_t* delta, uint32_t size, uint8_t* dst) {
+        const uint8_t* end = delta + size;
+        uint32_t word = 0;
+        while (delta < end) {
+            uint16_t token[2];
+            memcpy(token, delta, 4);
+            delta += 4;
+            word += token[0];
+            for (uint16_t n = 0; n < token[1]; n++, word++, delta += 4) {
+                uint32_t offset = word * 4;
+                uint32_t len = min((uint32_t)4, stateSize - offset);
+                uint32_t value = load_word(dst, word);
+                uint32_t diff;
+                memcpy(&diff, delta, 4);
+                value ^= diff;
+                memcpy(dst + offset, &value, len);
+            }
+        }
+    }
+
+public:
+    ~FlywheelRewind() {
+        end();
+    }
+
+    // Allocate the snapshot arena; budget is the total PSRAM to spend
+    bool begin(uint32_t size, uint32_t budget = REWIND_DEFAULT_BUDGET) {
+        end();
+        stateSize = size;
+        if (!psramFound() || budget < keyframe_size() + max_delta_size()) return false;
+        arena = static_cast<uint8_t*>(ps_malloc(budget));
+        if (!arena) return false;
+        arenaSize = budget;
+        return true;
+    }
+
+    void end() {
+        free(arena);
+        arena = nullptr;
+        arenaSize = 0;
+        clear();
+    }
+
+    void clear() {
+        oldest = count = bytesUsed = keyframes = writePos = 0;
+    }
+
+    bool is_enabled() const {
+        return arena != nullptr;
+    }
+
+    // Store a snapshot of state (stateSize bytes)
+    void capture(const uint8_t* state) {
+        if (!arena) return;
+        int64_t start = esp_timer_get_time();
+
+        bool keyframe = count == 0 || newest().group + 1 >= REWIND_KEYFRAME_EVERY;
+        uint16_t group = 0;
+        if (!keyframe) {
+            uint32_t keyAge = count - 1 - newest().group;
+            uint32_t oldestBefore = oldest;
+            reserve(max_delta_size());
+            // If making room evicted our keyframe, start a new group instead
+            uint32_t evicted = (oldest + REWIND_MAX_RECORDS - oldestBefore) % REWIND_MAX_RECORDS;
+            if (count == 0 || evicted > keyAge) {
+                keyframe = true;
+            } else {
+                const Record& key = record(keyAge - evicted);
+                group = newest().group + 1;
+                uint32_t size = encode_delta(state, arena + key.offset, arena + writePos);
+                records[(oldest + count) % REWIND_MAX_RECORDS] = {writePos, size, group};
+                count++;
+                writePos += size;
+                bytesUsed += size;
+            }
+        }
+        if (keyframe) {
+            uint32_t size = keyframe_size();
+            reserve(size);
+            memcpy(arena + writePos, state, stateSize);
+            memset(arena + writePos + stateSize, 0, size - stateSize);
+            records[(oldest + count) % REWIND_MAX_RECORDS] = {writePos, size, 0};
+            count++;
+            keyframes++;
+            writePos += size;
+            bytesUsed += size;
+        }
+
+        lastCaptureUs = esp_timer_get_time() - start;
+        maxCaptureUs = max(maxCaptureUs, lastCaptureUs);
+        avgCaptureUs = avgCaptureUs == 0 ? lastCaptureUs : avgCaptureUs * 0.95f + lastCaptureUs * 0.05f;
+    }
+
+    // Restore the snapshot steps back from the newest into dst and drop it along with
+    // everything newer. Returns the number of snapshots actually stepped back.
+    uint32_t rewind(uint32_t steps, uint8_t* dst) {
+        if (!arena || count == 0 || steps == 0) return 0;
+        steps = min(steps, count);
+
+        uint32_t targetAge = count - steps;
+        const Record& target = record(targetAge);
+        const Record& key = record(targetAge - target.group);
+        memcpy(dst, arena + key.offset, stateSize);
+        if (target.group != 0) {
+            decode_delta(arena + target.offset, target.size, dst);
+        }
+
+        // Reuse the space from the restored snapshot onwards
+        writePos = target.offset;
+        while (count > targetAge) {
+            Record& r = newest();
+            bytesUsed -= r.size;
+            if (r.group == 0) keyframes--;
+            count--;
+        }
+        return steps;
+    }
+
+    uint32_t snapshot_count() const { return count; }
+    uint32_t keyframe_count() const { return keyframes; }
+    uint32_t bytes_used() const { return bytesUsed; }
+    uint32_t budget() const { return arenaSize; }
+    uint32_t state_size() const { return stateSize; }
+    uint32_t last_capture_us() const { return lastCaptureUs; }
+    uint32_t max_capture_us() const { return maxCaptureUs; }
+    float avg_capture_us() const { return avgCaptureUs; }
+};
+
+#endif
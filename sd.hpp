@@ -3,6 +3,8 @@
 
 #include <SPI.h>
 #include <SdFat.h>
+#include <freertos/FreeRTOS.h>
+#include <freertos/semphr.h>
 
 // SD card pins (adjusted for your wiring)
 #define SD_CS 46    // Chip Select
@@ -17,10 +19,32 @@ class FlywheelSD {
 private:
     SdFat sd;
     bool initialized = false;
+    SemaphoreHandle_t busMutex = nullptr; // Serializes SdFat access across tasks
 
 public:
+    // Holds the card for the lifetime of the guard
+    class Lock {
+    public:
+        explicit Lock(FlywheelSD& card): card(card) { card.lock(); }
+        ~Lock() { card.unlock(); }
+    private:
+        FlywheelSD& card;
+    };
+
+    void lock() {
+        if (busMutex) xSemaphoreTakeRecursive(busMutex, portMAX_DELAY);
+    }
+
+    void unlock() {
+        if (busMutex) xSemaphoreGiveRecursive(busMutex);
+    }
+
     // Initialize the SD card
     bool begin() {
+        if (!busMutex) {
+            busMutex = xSemaphoreCreateRecursiveMutex();
+        }
+        Lock guard(*this);
         sdSPI.begin(SD_SCK, SD_MISO, SD_MOSI, SD_CS);
         SdSpiConfig spiConfig(SD_CS, SHARED_SPI, SD_SCK_MHZ(25), &sdSPI);
         initialized = sd.begin(spiConfig);
@@ -38,12 +62,35 @@ public:
             Serial.println("SD card not initialized");
             return false;
         }
+        Lock guard(*this);
         return sd.exists(path);
     }
 
+    // Open a raw SdFat file handle
+    bool open_file(File& file, const char* path, oflag_t oflag) {
+        if (!initialized) return false;
+        Lock guard(*this);
+        return file.open(&sd, path, oflag);
+    }
+
+    // Delete a file from the SD card
+    bool remove(const char* path) {
+        if (!initialized) return false;
+        Lock guard(*this);
+        return sd.remove(path);
+    }
+
+    // Rename a file on the SD card (the destination must not exist)
+    bool rename(const char* oldPath, const char* newPath) {
+        if (!initialized) return false;
+        Lock guard(*this);
+        return sd.rename(oldPath, newPath);
+    }
+
     // Read a text file from the SD card
     String read_file(const char* filePath) {
         if (!initialized) return "SD card not initialized";
+        Lock guard(*this);
 
         File file = sd.open(filePath, O_READ);
         if (!file) {
@@ -61,8 +108,9 @@ public:
     // Write text data to a file on the SD card
     bool write_file(const char* filePath, const char* data) {
         if (!initialized) return false;
+        Lock guard(*this);
 
-        File file = sd.open(filePath, O_WRITE | O_CREAT);
+        File file = sd.open(filePath, O_WRITE | O_CREAT | O_TRUNC);
         if (!file) {
             return false;
         }
@@ -78,6 +126,7 @@ public:
 			Serial.println("SD card not initialized");
 			return false;
 		}
+		Lock guard(*this);
 
 		File file = sd.open(filePath, O_READ);
 		if (!file) {
@@ -109,6 +158,7 @@ public:
 			Serial.println("SD card not initialized");
 			return false;
 		}
+		Lock guard(*this);
 
 		File file = sd.open(filePath, O_WRITE | O_CREAT | O_TRUNC);
 		if (!file) {
@@ -134,6 +184,7 @@ public:
 			Serial.println("SD card not initialized");
 			return 0;
 		}
+		Lock guard(*this);
 
 		File file = sd.open(filePath, O_READ);
 		if (!file) {
@@ -152,6 +203,7 @@ public:
             Serial.println("SD card not initialized");
             return;
         }
+        Lock guard(*this);
 
         File dir = sd.open(dirPath);
         if (!dir || !dir.isDir()) {
@@ -172,4 +224,213 @@ public:
     }
 };
 
+// Size of the per-handle buffer (one SD sector)
+#define SD_FILE_BUFFER_SIZE 512
+
+// Buffered file handle. A single sector-sized buffer is shared between reads
+// and writes; seeking or switching direction drains it first.
+class FlywheelFile {
+private:
+    File file;
+    FlywheelSD* card = nullptr;
+    uint8_t buffer[SD_FILE_BUFFER_SIZE];
+    size_t bufferPos = 0;      // Next unread byte while reading
+    size_t bufferLen = 0;      // Valid bytes while reading, pending bytes while writing
+    bool writing = false;      // Buffer currently holds unwritten data
+    bool preallocated = false; // Contiguous clusters were reserved on open
+    uint32_t writtenEnd = 0;   // End of the data actually written, the real size of a preallocated file
+
+    // Track how far writes reached, since a preallocated file's size covers the whole reservation
+    void note_written() {
+        writtenEnd = max(writtenEnd, (uint32_t)file.curPosition());
+    }
+
+    // Read from the card, stopping at writtenEnd so the stale reservation reads as EOF
+    int read_card(void* dst, size_t n) {
+        if (preallocated) {
+            uint32_t position = file.curPosition();
+            if (position >= writtenEnd) return 0;
+            n = min(n, (size_t)(writtenEnd - position));
+        }
+        return file.read(dst, n);
+    }
+
+    // Write out pending data or give back unread read-ahead
+    bool drain() {
+        bool ok = true;
+        if (writing) {
+            if (bufferLen && file.write(buffer, bufferLen) != bufferLen) {
+                ok = false;
+            }
+            note_written();
+            writing = false;
+        } else if (bufferPos < bufferLen) {
+            ok = file.seekSet(file.curPosition() - (bufferLen - bufferPos));
+        }
+        bufferPos = 0;
+        bufferLen = 0;
+        return ok;
+    }
+
+public:
+    ~FlywheelFile() {
+        close();
+    }
+
+    // Open a file, optionally reserving contiguous space for fast sequential writes
+    bool open(FlywheelSD& sdCard, const char* path, oflag_t oflag, uint32_t preallocate = 0) {
+        close();
+        card = &sdCard;
+        FlywheelSD::Lock guard(*card);
+        if (!card->open_file(file, path, oflag)) {
+            return false;
+        }
+        writtenEnd = 0;
+        // Appends always land past the reservation, so there's nothing to gain
+        if (preallocate && !(oflag & O_APPEND) && file.fileSize() == 0 && file.preAllocate(preallocate)) {
+            preallocated = true;
+        }
+        return true;
+    }
+
+    bool is_open() {
+        return card && file.isOpen();
+    }
+
+    // Read up to n bytes, returns the number of bytes read
+    size_t read(void* dst, size_t n) {
+        uint8_t* out = static_cast<uint8_t*>(dst);
+        FlywheelSD::Lock guard(*card);
+        if (writing) {
+            drain();
+        }
+
+        size_t total = 0;
+        while (total < n) {
+            if (bufferPos < bufferLen) {
+                size_t chunk = min(n - total, bufferLen - bufferPos);
+                memcpy(out + total, buffer + bufferPos, chunk);
+                bufferPos += chunk;
+                total += chunk;
+                continue;
+            }
+
+            // Large reads go straight to the destination
+            if (n - total >= SD_FILE_BUFFER_SIZE) {
+                int got = read_card(out + total, n - total);
+                if (got <= 0) break;
+                total += got;
+                continue;
+            }
+
+            int got = read_card(buffer, SD_FILE_BUFFER_SIZE);
+            if (got <= 0) break;
+            bufferPos = 0;
+            bufferLen = got;
+        }
+        return total;
+    }
+
+    // Expose buffered data without copying, refilling if empty. Returns nullptr at EOF.
+    const uint8_t* peek(size_t& available) {
+        if (writing || bufferPos >= bufferLen) {
+            FlywheelSD::Lock guard(*card);
+            drain();
+            int got = read_card(buffer, SD_FILE_BUFFER_SIZE);
+            bufferPos = 0;
+            bufferLen = got > 0 ? got : 0;
+        }
+        available = bufferLen - bufferPos;
+        return available ? buffer + bufferPos : nullptr;
+    }
+
+    // Mark bytes returned by peek() as read
+    void consume(size_t n) {
+        bufferPos = min(bufferPos + n, bufferLen);
+    }
+
+    // Write n bytes, returns false if the card rejected the data
+    bool write(const void* src, size_t n) {
+        const uint8_t* in = static_cast<const uint8_t*>(src);
+        if (!writing) {
+            FlywheelSD::Lock guard(*card);
+            if (!drain()) return false;
+            writing = true;
+        }
+
+        if (bufferLen + n > SD_FILE_BUFFER_SIZE) {
+            FlywheelSD::Lock guard(*card);
+            if (bufferLen && file.write(buffer, bufferLen) != bufferLen) return false;
+            bufferLen = 0;
+            note_written();
+            // Large writes go straight to the card
+            if (n >= SD_FILE_BUFFER_SIZE) {
+                bool ok = file.write(in, n) == n;
+                note_written();
+                return ok;
+            }
+        }
+        memcpy(buffer + bufferLen, in, n);
+        bufferLen += n;
+        return true;
+    }
+
+    // Flush buffered writes and commit them to the card
+    bool flush() {
+        FlywheelSD::Lock guard(*card);
+        bool ok = drain();
+        return file.sync() && ok;
+    }
+
+    bool seek(uint32_t target) {
+        // Seeking to where we already are keeps pending writes batched
+        if (target == position()) return true;
+        FlywheelSD::Lock guard(*card);
+        return drain() && file.seekSet(target);
+    }
+
+    bool seek_end() {
+        FlywheelSD::Lock guard(*card);
+        if (!drain()) return false;
+        // A preallocated file's size covers the whole reservation; the data ends at writtenEnd
+        return preallocated ? file.seekSet(writtenEnd) : file.seekEnd(0);
+    }
+
+    uint32_t position() {
+        FlywheelSD::Lock guard(*card);
+        uint32_t position = file.curPosition();
+        return writing ? position + bufferLen : position - (bufferLen - bufferPos);
+    }
+
+    uint32_t size() {
+        FlywheelSD::Lock guard(*card);
+        uint32_t size = preallocated ? writtenEnd : file.fileSize();
+        if (writing) {
+            size = max(size, (uint32_t)file.curPosition() + (uint32_t)bufferLen);
+        }
+        return size;
+    }
+
+    // Cut the file at the current position
+    bool truncate() {
+        FlywheelSD::Lock guard(*card);
+        if (!drain()) return false;
+        writtenEnd = file.curPosition();
+        preallocated = false; // The reservation past here is released too
+        return file.truncate(writtenEnd);
+    }
+
+    void close() {
+        if (!is_open()) return;
+        FlywheelSD::Lock guard(*card);
+        drain();
+        // Give back reserved clusters that were never written
+        if (preallocated) {
+            file.truncate(writtenEnd);
+            preallocated = false;
+        }
+        file.close();
+    }
+};
+
 #endif
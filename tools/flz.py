@@ -0,0 +1,192 @@
+#!/usr/bin/env python3
+"""Convert ROMs and assets to and from Flywheel's FLZ container.
+
+FLZ splits a file into independently compressed LZ4 blocks with a size table
+up front, so the device can stream blocks from the SD card and decode each one
+straight into its destination buffer.
+
+    python3 tools/flz.py pack game.gb game.gb.flz
+    python3 tools/flz.py unpack game.gb.flz game.gb
+    python3 tools/flz.py info game.gb.flz
+"""
+
+import argparse
+import struct
+import sys
+import time
+
+MAGIC = b"FLZ1"
+HEADER = struct.Struct("<4sIII")
+STORED = 0x80000000
+DEFAULT_BLOCK = 16 * 1024
+MAX_BLOCK = 64 * 1024
+
+MIN_MATCH = 4
+LAST_LITERALS = 5   # LZ4: the last 5 bytes are always literals
+MATCH_LIMIT = 12    # LZ4: no match may start in the last 12 bytes
+MAX_OFFSET = 0xFFFF
+
+
+def _write_length(out, length):
+    while length >= 255:
+        out.append(255)
+        length -= 255
+    out.append(length)
+
+
+def _emit(out, literals, match_length, offset):
+    lit_len = len(literals)
+    token = min(lit_len, 15) << 4
+    if match_length:
+        token |= min(match_length - MIN_MATCH, 15)
+    out.append(token)
+    if lit_len >= 15:
+        _write_length(out, lit_len - 15)
+    out += literals
+    if match_length:
+        out += struct.pack("<H", offset)
+        if match_length - MIN_MATCH >= 15:
+            _write_length(out, match_length - MIN_MATCH - 15)
+
+
+def compress_block(data):
+    """Greedy LZ4 block compressor with a single-entry hash table."""
+    n = len(data)
+    out = bytearray()
+    table = {}
+    anchor = 0
+    i = 0
+    match_end = n - LAST_LITERALS
+    while i < n - MATCH_LIMIT:
+        key = data[i:i + MIN_MATCH]
+        candidate = table.get(key)
+        table[key] = i
+        if candidate is None or i - candidate > MAX_OFFSET:
+            i += 1
+            continue
+
+        length = MIN_MATCH
+        while i + length < match_end and data[candidate + length] == data[i + length]:
+            length += 1
+
+        _emit(out, data[anchor:i], length, i - candidate)
+        i += length
+        anchor = i
+    _emit(out, data[anchor:], 0, 0)
+    return bytes(out)
+
+
+def decompress_block(src, size):
+    out = bytearray()
+    i = 0
+    while i < len(src):
+        token = src[i]
+        i += 1
+        lit_len = token >> 4
+        if lit_len == 15:
+            while True:
+                extra = src[i]
+                i += 1
+                lit_len += extra
+                if extra != 255:
+                    break
+        out += src[i:i + lit_len]
+        i += lit_len
+        if i >= len(src):
+            break
+        offset = src[i] | (src[i + 1] << 8)
+        i += 2
+        length = (token & 0x0F) + MIN_MATCH
+        if token & 0x0F == 15:
+            while True:
+                extra = src[i]
+                i += 1
+                length += extra
+                if extra != 255:
+                    break
+        start = len(out) - offset
+        if offset <= 0 or start < 0:
+            raise ValueError("corrupt block")
+        for k in range(length):
+            out.append(out[start + k])
+    if len(out) != size:
+        raise ValueError("block decoded to %d bytes, expected %d" % (len(out), size))
+    return bytes(out)
+
+
+def pack(data, block_size):
+    blocks = []
+    for start in range(0, len(data), block_size):
+        raw = data[start:start + block_size]
+        packed = compress_block(raw)
+        if len(packed) >= len(raw):
+            blocks.append((len(raw) | STORED, raw))
+        else:
+            blocks.append((len(packed), packed))
+    header = HEADER.pack(MAGIC, len(data), block_size, len(blocks))
+    table = b"".join(struct.pack("<I", size) for size, _ in blocks)
+    return header + table + b"".join(payload for _, payload in blocks)
+
+
+def unpack(blob):
+    magic, raw_size, block_size, count = HEADER.unpack_from(blob)
+    if magic != MAGIC:
+        raise ValueError("not an FLZ file")
+    sizes = struct.unpack_from("<%dI" % count, blob, HEADER.size)
+    pos = HEADER.size + 4 * count
+    out = bytearray()
+    for size in sizes:
+        length = size & ~STORED
+        payload = blob[pos:pos + length]
+        pos += length
+        expected = min(block_size, raw_size - len(out))
+        out += payload if size & STORED else decompress_block(payload, expected)
+    if len(out) != raw_size:
+        raise ValueError("decoded %d bytes, expected %d" % (len(out), raw_size))
+    return bytes(out)
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__, formatter_class=argparse.RawDescriptionHelpFormatter)
+    sub = parser.add_subparsers(dest="command", required=True)
+    p = sub.add_parser("pack", help="compress a file")
+    p.add_argument("input")
+    p.add_argument("output")
+    p.add_argument("--block-size", type=int, default=DEFAULT_BLOCK,
+                   help="uncompressed bytes per block (default %d)" % DEFAULT_BLOCK)
+    u = sub.add_parser("unpack", help="decompress a file")
+    u.add_argument("input")
+    u.add_argument("output")
+    i = sub.add_parser("info", help="show block layout and ratio")
+    i.add_argument("input")
+    args = parser.parse_args()
+
+    with open(args.input, "rb") as f:
+        data = f.read()
+
+    if args.command == "pack":
+        if not 0 < args.block_size <= MAX_BLOCK:
+            sys.exit("block size must be between 1 and %d" % MAX_BLOCK)
+        start = time.time()
+        blob = pack(data, args.block_size)
+        if unpack(blob) != data:
+            sys.exit("round trip failed")
+        with open(args.output, "wb") as f:
+            f.write(blob)
+        ratio = len(blob) / len(data) if data else 1.0
+        print("%s: %d -> %d bytes (%.1f%%) in %.2fs" % (args.input, len(data), len(blob), ratio * 100, time.time() - start))
+    elif args.command == "unpack":
+        with open(args.output, "wb") as f:
+            f.write(unpack(data))
+    else:
+        magic, raw_size, block_size, count = HEADER.unpack_from(data)
+        if magic != MAGIC:
+            sys.exit("not an FLZ file")
+        sizes = struct.unpack_from("<%dI" % count, data, HEADER.size)
+        stored = sum(1 for s in sizes if s & STORED)
+        print("raw %d bytes, file %d bytes (%.1f%%), %d blocks of %d, %d stored" % (
+            raw_size, len(data), 100.0 * len(data) / max(raw_size, 1), count, block_size, stored))
+
+
+if __name__ == "__main__":
+    main()
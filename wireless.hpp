@@ -2,31 +2,332 @@
 #define FLYWHEEL_WIRELESS_HPP
 
 #include <WiFi.h>
+#include <freertos/FreeRTOS.h>
+#include <freertos/queue.h>
+#include <freertos/semphr.h>
+#include <freertos/task.h>
 
-class FlywheelWireless {
+#include "power.hpp"
+
+extern FlywheelPower power;
+
+#define WIRELESS_TICK_MS 100
+#define WIRELESS_EVENT_QUEUE 8
+
+enum FlywheelWiFiState : uint8_t {
+    FLYWHEEL_WIFI_OFF,        // Radio powered down
+    FLYWHEEL_WIFI_CONNECTING, // Waiting for an IP address
+    FLYWHEEL_WIFI_CONNECTED,
+    FLYWHEEL_WIFI_BACKOFF,    // Radio down, waiting to retry
+    FLYWHEEL_WIFI_FAILED,     // Gave up after the configured number of attempts
+};
+
+enum FlywheelWiFiEvent : uint8_t {
+    FLYWHEEL_WIFI_GOT_IP,
+    FLYWHEEL_WIFI_DISCONNECTED,
+};
+
+// Radio operations used by the connection manager. Pass a stub to
+// FlywheelWireless to drive it without hardware: feed events through
+// handle_event(), time through now_ms(), and call update() to step it.
+class FlywheelWiFiBackend {
 public:
-    void begin() {
-        // Optional: do nothing until explicitly enabled
-        disable();
+    virtual ~FlywheelWiFiBackend() {}
+    virtual void connect(const char* ssid, const char* password) = 0;
+    virtual void power_off() = 0;
+    virtual uint32_t now_ms() = 0;
+    // Told when the link needs the radio kept awake (connecting or connected)
+    virtual void link_active(bool active) {}
+};
+
+// Backend with no radio: records what the manager asked for and runs on a
+// clock the caller advances. Pair it with begin(false) and step update() by hand.
+class StubWiFiBackend : public FlywheelWiFiBackend {
+public:
+    uint32_t now = 0;
+    uint32_t connects = 0;
+    uint32_t powerOffs = 0;
+    bool linkActive = false;
+    String lastSsid;
+
+    void connect(const char* ssid, const char* password) override {
+        connects++;
+        lastSsid = ssid;
     }
 
-    void enable(const char* ssid, const char* password) {
+    void power_off() override {
+        powerOffs++;
+    }
+
+    uint32_t now_ms() override {
+        return now;
+    }
+
+    void link_active(bool active) override {
+        linkActive = active;
+    }
+
+    void advance(uint32_t ms) {
+        now += ms;
+    }
+};
+
+class FlywheelWireless;
+
+// Arduino WiFi backend, reports station events back to the manager
+class ArduinoWiFiBackend : public FlywheelWiFiBackend {
+public:
+    void attach(FlywheelWireless* manager);
+
+    void connect(const char* ssid, const char* password) override {
         WiFi.mode(WIFI_STA);
+        WiFi.setAutoReconnect(false); // Retries are scheduled by the manager
         WiFi.begin(ssid, password);
-        while (WiFi.status() != WL_CONNECTED) {
-            delay(100); // Wait for connection
-        }
     }
 
-    void disable() {
+    void power_off() override {
         WiFi.disconnect(true);   // Disconnect and erase saved network
         WiFi.mode(WIFI_OFF);     // Fully shut down Wi-Fi
         btStop();                // Disable Bluetooth
     }
 
+    uint32_t now_ms() override {
+        return millis();
+    }
+
+    void link_active(bool active) override {
+        // Light sleep would drop the link
+        power.set_inhibit(POWER_INHIBIT_WIFI, active);
+    }
+
+private:
+    bool attached = false;
+};
+
+class FlywheelWireless {
+public:
+    struct Config {
+        uint32_t timeoutMs = 10000;      // Per-attempt connection timeout
+        uint32_t backoffMs = 1000;       // Delay before the first retry, doubled per attempt
+        uint32_t maxBackoffMs = 30000;
+        uint8_t maxAttempts = 5;         // 0 retries forever
+        uint32_t idleTimeoutMs = 0;      // Power down after this long without touch(); 0 disables
+    };
+
+    explicit FlywheelWireless(FlywheelWiFiBackend* backend = nullptr): backend(backend ? backend : &arduinoBackend) {
+        mutex = xSemaphoreCreateMutex();
+        events = xQueueCreate(WIRELESS_EVENT_QUEUE, sizeof(FlywheelWiFiEvent));
+    }
+
+    // Without the background task the caller drives the manager by calling update()
+    void begin(bool startTask = true) {
+        if (backend == &arduinoBackend) {
+            arduinoBackend.attach(this);
+        }
+        if (startTask && !taskHandle) {
+            xTaskCreatePinnedToCore(wireless_task, "WirelessTask", 4096, this, 1, &taskHandle, 0);
+        }
+        // Optional: do nothing until explicitly enabled
+        disable();
+    }
+
+    // Start connecting in the background; progress is reported through poll_change()
+    void enable(const char* ssid, const char* password) {
+        xSemaphoreTake(mutex, portMAX_DELAY);
+        strlcpy(this->ssid, ssid, sizeof(this->ssid));
+        strlcpy(this->password, password, sizeof(this->password));
+        attempt = 0;
+        start_attempt();
+        xSemaphoreGive(mutex);
+        wake();
+    }
+
+    void disable() {
+        xSemaphoreTake(mutex, portMAX_DELAY);
+        backend->power_off();
+        set_state(FLYWHEEL_WIFI_OFF);
+        xSemaphoreGive(mutex);
+    }
+
+    void configure(const Config& newConfig) {
+        xSemaphoreTake(mutex, portMAX_DELAY);
+        config = newConfig;
+        xSemaphoreGive(mutex);
+    }
+
+    Config get_config() {
+        xSemaphoreTake(mutex, portMAX_DELAY);
+        Config current = config;
+        xSemaphoreGive(mutex);
+        return current;
+    }
+
+    // Note network activity so the idle timer doesn't power the radio down
+    void touch() {
+        lastActivity = backend->now_ms();
+    }
+
+    // Queue a station event from the backend. Never blocks, so it is safe to
+    // call from the Wi-Fi event task while the manager is talking to the radio.
+    void handle_event(FlywheelWiFiEvent event) {
+        if (events) {
+            xQueueSend(events, &event, 0);
+        }
+        wake();
+    }
+
+    // Apply queued events, then advance timeouts, retries and the idle timer
+    void update() {
+        xSemaphoreTake(mutex, portMAX_DELAY);
+        FlywheelWiFiEvent event;
+        while (events && xQueueReceive(events, &event, 0) == pdTRUE) {
+            apply_event(event);
+        }
+
+        uint32_t now = backend->now_ms();
+        if (state == FLYWHEEL_WIFI_CONNECTING && (int32_t)(now - deadline) >= 0) {
+            fail_attempt();
+        } else if (state == FLYWHEEL_WIFI_BACKOFF && (int32_t)(now - deadline) >= 0) {
+            start_attempt();
+        } else if (state == FLYWHEEL_WIFI_CONNECTED && config.idleTimeoutMs &&
+                   now - lastActivity >= config.idleTimeoutMs) {
+            backend->power_off();
+            set_state(FLYWHEEL_WIFI_OFF);
+        }
+        xSemaphoreGive(mutex);
+    }
+
+    // Pop the oldest unreported state change, returns false when there are none
+    bool poll_change(FlywheelWiFiState& changed) {
+        xSemaphoreTake(mutex, portMAX_DELAY);
+        bool found = queueHead != queueTail;
+        if (found) {
+            changed = changes[queueHead];
+            queueHead = (queueHead + 1) % WIRELESS_EVENT_QUEUE;
+        }
+        xSemaphoreGive(mutex);
+        return found;
+    }
+
+    FlywheelWiFiState status() {
+        return state;
+    }
+
+    uint8_t attempts() {
+        return attempt;
+    }
+
     bool isConnected() {
-        return WiFi.status() == WL_CONNECTED;
+        return state == FLYWHEEL_WIFI_CONNECTED;
+    }
+
+    static const char* state_name(FlywheelWiFiState state) {
+        switch (state) {
+            case FLYWHEEL_WIFI_CONNECTING: return "connecting";
+            case FLYWHEEL_WIFI_CONNECTED: return "connected";
+            case FLYWHEEL_WIFI_BACKOFF: return "backoff";
+            case FLYWHEEL_WIFI_FAILED: return "failed";
+            default: return "off";
+        }
+    }
+
+private:
+    FlywheelWiFiBackend* backend;
+    ArduinoWiFiBackend arduinoBackend;
+    Config config;
+    SemaphoreHandle_t mutex = nullptr;
+    QueueHandle_t events = nullptr;
+    TaskHandle_t taskHandle = nullptr;
+
+    char ssid[33] = "";
+    char password[65] = "";
+    volatile FlywheelWiFiState state = FLYWHEEL_WIFI_OFF;
+    uint8_t attempt = 0;
+    uint32_t deadline = 0;               // Attempt timeout or retry time, depending on state
+    volatile uint32_t lastActivity = 0;
+
+    FlywheelWiFiState changes[WIRELESS_EVENT_QUEUE];
+    uint8_t queueHead = 0;
+    uint8_t queueTail = 0;
+
+    // Sleeps until woken while the radio is idle, ticks while a connection is in flight
+    static void wireless_task(void* parameter) {
+        FlywheelWireless* inst = static_cast<FlywheelWireless*>(parameter);
+        while (true) {
+            FlywheelWiFiState current = inst->state;
+            bool idle = current == FLYWHEEL_WIFI_OFF || current == FLYWHEEL_WIFI_FAILED;
+            ulTaskNotifyTake(pdTRUE, idle ? portMAX_DELAY : pdMS_TO_TICKS(WIRELESS_TICK_MS));
+            inst->update();
+        }
+    }
+
+    void wake() {
+        if (taskHandle) xTaskNotifyGive(taskHandle);
+    }
+
+    // Callers hold the mutex
+    void apply_event(FlywheelWiFiEvent event) {
+        if (event == FLYWHEEL_WIFI_GOT_IP && state == FLYWHEEL_WIFI_CONNECTING) {
+            attempt = 0;
+            lastActivity = backend->now_ms();
+            set_state(FLYWHEEL_WIFI_CONNECTED);
+        } else if (event == FLYWHEEL_WIFI_DISCONNECTED) {
+            if (state == FLYWHEEL_WIFI_CONNECTED) {
+                // Dropped link: reconnect straight away
+                attempt = 0;
+                start_attempt();
+            } else if (state == FLYWHEEL_WIFI_CONNECTING) {
+                fail_attempt();
+            }
+        }
+    }
+
+    // Callers hold the mutex
+    void set_state(FlywheelWiFiState newState) {
+        if (state == newState) return;
+        state = newState;
+        backend->link_active(newState == FLYWHEEL_WIFI_CONNECTING || newState == FLYWHEEL_WIFI_CONNECTED);
+        uint8_t next = (queueTail + 1) % WIRELESS_EVENT_QUEUE;
+        if (next == queueHead) {
+            queueHead = (queueHead + 1) % WIRELESS_EVENT_QUEUE; // Drop the oldest change
+        }
+        changes[queueTail] = newState;
+        queueTail = next;
+    }
+
+    void start_attempt() {
+        xQueueReset(events); // Anything still queued belongs to an earlier attempt
+        attempt++;
+        deadline = backend->now_ms() + config.timeoutMs;
+        set_state(FLYWHEEL_WIFI_CONNECTING);
+        backend->connect(ssid, password);
+    }
+
+    void fail_attempt() {
+        backend->power_off();
+        if (config.maxAttempts && attempt >= config.maxAttempts) {
+            set_state(FLYWHEEL_WIFI_FAILED);
+            return;
+        }
+        // Widen before shifting so a large configured backoff saturates instead of wrapping
+        uint64_t backoff = (uint64_t)config.backoffMs << min<uint8_t>(attempt - 1, 15);
+        deadline = backend->now_ms() + (uint32_t)min(backoff, (uint64_t)config.maxBackoffMs);
+        set_state(FLYWHEEL_WIFI_BACKOFF);
     }
 };
 
+inline void ArduinoWiFiBackend::attach(FlywheelWireless* manager) {
+    if (attached) return;
+    attached = true;
+    WiFi.onEvent([manager](arduino_event_id_t event, arduino_event_info_t info) {
+        if (event == ARDUINO_EVENT_WIFI_STA_GOT_IP) {
+            manager->handle_event(FLYWHEEL_WIFI_GOT_IP);
+        } else if (event == ARDUINO_EVENT_WIFI_STA_DISCONNECTED &&
+                   info.wifi_sta_disconnected.reason != WIFI_REASON_ASSOC_LEAVE) {
+            // Leaving on purpose (power_off, or WiFi.begin dropping the old link) isn't a failure
+            manager->handle_event(FLYWHEEL_WIFI_DISCONNECTED);
+        }
+    });
+}
+
 #endif